@@ -0,0 +1,322 @@
+/**
+ * Microbenchmarks for the hot paths. Prints one CSV row per measurement
+ * (or a JSON array with -json) so results can be compared across builds:
+ *
+ *   make bench
+ *   ./bench.exe -json > bench.json
+ *
+ * Editor commands are fed through a socketpair, so key edits are measured
+ * the way the editor drives them, through minirocket_tick().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "mini-rocket.h"
+
+#define BENCH_LOOKUPS (1 << 16)  // precomputed playhead times, cycled
+#define BENCH_FILE "bench-tmp.rkt"
+
+static bool json;
+static unsigned int results;
+static volatile float sink;
+
+static double now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// bytes is 0 for benchmarks without a throughput figure
+static void report(const char *name, const char *param, unsigned long ops, double ns, double bytes)
+{
+  double mbs = bytes > 0 ? bytes / (ns / 1e9) / 1e6 : 0.0;
+  if(json) {
+    printf("%s\n  {\"name\": \"%s\", \"param\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.2f, \"mb_per_s\": %.2f}",
+	   results ? "," : "[", name, param, ops, ns / ops, mbs);
+  } else {
+    if(results == 0) {
+      printf("name,param,ops,ns_per_op,mb_per_s\n");
+    }
+    printf("%s,%s,%lu,%.2f,%.2f\n", name, param, ops, ns / ops, mbs);
+  }
+  results++;
+  fflush(stdout);
+}
+
+// One track of numkeys keys, four rows apart, all with the given interpolation
+static mrocket_t *make_timeline(unsigned int numtracks, unsigned int numkeys, int interp)
+{
+  size_t size = (size_t)numtracks * (16 + (size_t)numkeys * 32);
+  char *text = malloc(size), *p = text;
+  for(unsigned int t=0; t < numtracks; t++) {
+    p += sprintf(p, "#bench:track%u\n", t);
+    for(unsigned int k=0; k < numkeys; k++) {
+      p += sprintf(p, "%u %f %d\n", k * 4, (float)((k * 7919 + t) % 1000) / 10.0f, interp < 0 ? (int)(k % 4) : interp);
+    }
+  }
+  mrocket_t *rocket = minirocket_read_from_memory(text, p - text, "bench");
+  free(text);
+  rocket->bpm = 120;
+  rocket->rows_per_beat = 8;
+  return rocket;
+}
+
+static double bench_lookups(mrocket_t *rocket, const float *times, unsigned long ops)
+{
+  mrocket_track_t *track = rocket->tracks[0];
+  float sum = 0.0f;
+  double t0 = now_ns();
+  for(unsigned long i=0; i < ops; i++) {
+    rocket->time = times[i & (BENCH_LOOKUPS - 1)];
+    sum += minirocket_get_value(track);
+  }
+  double ns = now_ns() - t0;
+  sink = sum;
+  return ns;
+}
+
+static void bench_get_value(void)
+{
+  static const unsigned int counts[] = {2, 16, 256, 4096, 100000};
+  float *times = malloc(BENCH_LOOKUPS * sizeof(float));
+  const unsigned long ops = 4000000;
+  char param[64];
+
+  for(unsigned int c=0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    unsigned int numkeys = counts[c];
+    mrocket_t *rocket = make_timeline(1, numkeys, 1);
+    float length = minirocket_row2time(rocket, (numkeys - 1) * 4);
+
+    // sequential: a quarter row per lookup, wrapping at the end
+    for(unsigned int i=0; i < BENCH_LOOKUPS; i++) {
+      times[i] = (float)(i % ((numkeys - 1) * 16 + 1)) * minirocket_row2time(rocket, 1) / 4;
+    }
+    sprintf(param, "keys=%u", numkeys);
+    report("get_value_sequential", param, ops, bench_lookups(rocket, times, ops), 0);
+
+    srand(1);
+    for(unsigned int i=0; i < BENCH_LOOKUPS; i++) {
+      times[i] = length * rand() / RAND_MAX;
+    }
+    report("get_value_random", param, ops, bench_lookups(rocket, times, ops), 0);
+
+    // seek-heavy: a jump to a random place every 16 sequential lookups
+    for(unsigned int i=0; i < BENCH_LOOKUPS; i += 16) {
+      float start = length * rand() / RAND_MAX;
+      for(unsigned int j=0; j < 16; j++) {
+	times[i+j] = start + j * minirocket_row2time(rocket, 1) / 4;
+      }
+    }
+    report("get_value_seek", param, ops, bench_lookups(rocket, times, ops), 0);
+    minirocket_free(rocket);
+  }
+
+  // compressed storage, lossless and quantized, on the largest track
+  for(int quantize=0; quantize < 2; quantize++) {
+    mrocket_t *rocket = make_timeline(1, 100000, -1);
+    float length = minirocket_row2time(rocket, (100000 - 1) * 4);
+    minirocket_compress(rocket, 0, quantize);
+    sprintf(param, "keys=100000 quantize=%d", quantize);
+    for(unsigned int i=0; i < BENCH_LOOKUPS; i++) {
+      times[i] = (float)i * minirocket_row2time(rocket, 1) / 4;
+    }
+    report("get_value_packed_sequential", param, ops, bench_lookups(rocket, times, ops), 0);
+    for(unsigned int i=0; i < BENCH_LOOKUPS; i++) {
+      times[i] = length * rand() / RAND_MAX;
+    }
+    report("get_value_packed_random", param, ops, bench_lookups(rocket, times, ops), 0);
+    minirocket_free(rocket);
+  }
+
+  for(int interp=0; interp < 4; interp++) {
+    mrocket_t *rocket = make_timeline(1, 4096, interp);
+    for(unsigned int i=0; i < BENCH_LOOKUPS; i++) {
+      times[i] = (float)i * minirocket_row2time(rocket, 1) / 4;
+    }
+    sprintf(param, "interp=%d", interp);
+    report("get_value_interp", param, ops, bench_lookups(rocket, times, ops), 0);
+    minirocket_free(rocket);
+  }
+  free(times);
+}
+
+static void bench_files(void)
+{
+  mrocket_t *rocket = make_timeline(100, 10000, -1);
+  const int rounds = 5;
+  double ns = 0;
+  for(int i=0; i < rounds; i++) {
+    double t0 = now_ns();
+    minirocket_write_to_file(rocket, BENCH_FILE);
+    ns += now_ns() - t0;
+  }
+  minirocket_free(rocket);
+
+  FILE *fd = fopen(BENCH_FILE, "rb");
+  fseek(fd, 0, SEEK_END);
+  double size = ftell(fd);
+  fclose(fd);
+  report("write_to_file", "tracks=100 keys=10000", rounds, ns, size * rounds);
+
+  ns = 0;
+  for(int i=0; i < rounds; i++) {
+    double t0 = now_ns();
+    rocket = minirocket_read_from_file(BENCH_FILE);
+    ns += now_ns() - t0;
+    minirocket_free(rocket);
+  }
+  report("read_from_file", "tracks=100 keys=10000", rounds, ns, size * rounds);
+  remove(BENCH_FILE);
+}
+
+/**
+ * Editor side of a socketpair. Commands are written in chunks small
+ * enough for the socket buffer, each followed by a tick that drains them.
+ */
+typedef struct {
+  int		 sock;
+  unsigned char	*buf;
+  size_t	 len;
+  size_t	 max;
+} editor_t;
+
+static void put_byte(editor_t *e, unsigned char c)
+{
+  if(e->len == e->max) {
+    e->max = e->max ? e->max * 2 : 4096;
+    e->buf = realloc(e->buf, e->max);
+  }
+  e->buf[e->len++] = c;
+}
+
+static void put_long(editor_t *e, unsigned int v)
+{
+  for(int i=3; i >= 0; i--) {
+    put_byte(e, (v >> (i * 8)) & 0xff);
+  }
+}
+
+static void put_set_key(editor_t *e, unsigned int track, unsigned int row, float value)
+{
+  unsigned int bits;
+  memcpy(&bits, &value, 4);
+  put_byte(e, CMD_SET_KEY);
+  put_long(e, track);
+  put_long(e, row);
+  put_long(e, bits);
+  put_byte(e, 1);
+}
+
+static void put_delete_key(editor_t *e, unsigned int track, unsigned int row)
+{
+  put_byte(e, CMD_DELETE_KEY);
+  put_long(e, track);
+  put_long(e, row);
+}
+
+// Sends everything queued and returns the time spent in minirocket_tick
+static double feed(editor_t *e, mrocket_t *rocket)
+{
+  const size_t chunk = 32768;
+  char discard[4096];
+  double ns = 0;
+  for(size_t off=0; off < e->len; off += chunk) {
+    size_t n = e->len - off < chunk ? e->len - off : chunk;
+    if(write(e->sock, e->buf + off, n) != (ssize_t)n) {
+      perror("bench: write");
+      exit(1);
+    }
+    double t0 = now_ns();
+    minirocket_tick(rocket);
+    ns += now_ns() - t0;
+    while(read(e->sock, discard, sizeof(discard)) > 0) {
+    }
+  }
+  e->len = 0;
+  return ns;
+}
+
+static void bench_editor(void)
+{
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    perror("bench: socketpair");
+    return;
+  }
+  editor_t editor = {.sock = fds[1]};
+  fcntl(editor.sock, F_SETFL, fcntl(editor.sock, F_GETFL) | O_NONBLOCK);
+  const char *hello = "hello, demo!";
+  for(const char *p = hello; *p; p++) {
+    put_byte(&editor, *p);
+  }
+
+  mrocket_t *rocket = minirocket_connect_fd(fds[0]);
+  minirocket_create_track(rocket, "bench:large");
+  feed(&editor, rocket);
+
+  // Protocol decode: row updates only, so almost nothing is done per command
+  const unsigned long rows = 2000000;
+  for(unsigned long i=0; i < rows; i++) {
+    put_byte(&editor, CMD_SET_ROW);
+    put_long(&editor, i);
+  }
+  double bytes = editor.len;
+  report("tick_decode", "cmd=SET_ROW", rows, feed(&editor, rocket), bytes);
+
+  // Build a large track by appending, then insert and delete in the middle
+  const unsigned int numkeys = 100000, edits = 20000;
+  for(unsigned int i=0; i < numkeys; i++) {
+    put_set_key(&editor, 0, i * 2, (float)i);
+  }
+  bytes = editor.len;
+  report("tick_set_key_append", "keys=100000", numkeys, feed(&editor, rocket), bytes);
+
+  // Random rows between the existing keys, each inserted once
+  srand(2);
+  unsigned int *rows_edited = malloc(edits * sizeof(unsigned int));
+  unsigned char *used = calloc(numkeys, 1);
+  for(unsigned int i=0; i < edits; i++) {
+    unsigned int k;
+    do {
+      k = rand() % numkeys;
+    } while(used[k]);
+    used[k] = 1;
+    rows_edited[i] = k * 2 + 1;
+    put_set_key(&editor, 0, rows_edited[i], (float)i);
+  }
+  bytes = editor.len;
+  report("tick_set_key_insert", "keys=100000", edits, feed(&editor, rocket), bytes);
+
+  for(unsigned int i=0; i < edits; i++) {
+    put_delete_key(&editor, 0, rows_edited[i]);
+  }
+  bytes = editor.len;
+  report("tick_delete_key", "keys=100000", edits, feed(&editor, rocket), bytes);
+  if(minirocket_find_track(rocket, "bench:large")->numkeys != numkeys) {
+    fprintf(stderr, "bench: track has %u keys, expected %u\n",
+	    minirocket_find_track(rocket, "bench:large")->numkeys, numkeys);
+  }
+
+  free(used);
+  free(rows_edited);
+  free(editor.buf);
+  minirocket_disconnect(rocket);
+  close(editor.sock);
+}
+
+int main(int argc, char *argv[])
+{
+  json = argc > 1 && strcmp(argv[1], "-json") == 0;
+  bench_get_value();
+  bench_files();
+  bench_editor();
+  if(json) {
+    printf("\n]\n");
+  }
+  return 0;
+}
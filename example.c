@@ -6,14 +6,15 @@
 #include <errno.h>
 #include <unistd.h>
 #include <math.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
 
 #include "mini-rocket.h"
 
-static float timedifference_msec(struct timeval t0, struct timeval t1)
+static uint64_t timedifference_nsec(struct timeval t0, struct timeval t1)
 {
-  return (t1.tv_sec - t0.tv_sec) * 1000.0f + (t1.tv_usec - t0.tv_usec) / 1000.0f;
+  return ((t1.tv_sec - t0.tv_sec) * 1000000LL + (t1.tv_usec - t0.tv_usec)) * 1000ULL;
 }
 
 int main(int argc, char *argv[]) {
@@ -40,15 +41,14 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "minirocket initialization failed :(\n");
     exit(3);
   }
-  rocket->bpm = 125;
-  rocket->rows_per_beat = 8;
+  minirocket_set_tempo(rocket, 125, 8);
 
 
   struct timeval t0;
   struct timeval t1;
-  float prev_time = 0;
+  uint64_t prev_time = 0;
 
-  rocket->time = 0;
+  minirocket_set_time_ns(rocket, 0);
   gettimeofday(&t0, NULL);
 
   mrocket_track_t *track1 = minirocket_create_track(rocket, "group1:track1");
@@ -61,16 +61,15 @@ int main(int argc, char *argv[]) {
   while(1) {
     gettimeofday(&t1, NULL);
 
-    float current_time = timedifference_msec(t0, t1);
-    float delta_time = current_time - prev_time;
-    if(isfinite(delta_time)) {
-      rocket->time += delta_time;
-      if(minirocket_tick(rocket)) {
-	float t1val = minirocket_get_value(track1);
-	fprintf(stderr, "EXAMPLE: delta_time=%f  rocket->time=%f   value=%f\n", delta_time, rocket->time, t1val); fflush(stderr);
-      }
-      prev_time = current_time;
+    // Advance by the elapsed time; after a seek in the editor, time_ns is the new row's time
+    uint64_t current_time = timedifference_nsec(t0, t1);
+    uint64_t delta_time = current_time - prev_time;
+    minirocket_set_time_ns(rocket, rocket->time_ns + delta_time);
+    if(minirocket_tick(rocket)) {
+      float t1val = minirocket_get_value(track1);
+      fprintf(stderr, "EXAMPLE: delta_time=%fms  rocket->time=%f   value=%f\n", delta_time / 1e6, rocket->time, t1val); fflush(stderr);
     }
+    prev_time = current_time;
 
     usleep(1);
   }
@@ -2,53 +2,285 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <string.h>
+#include <assert.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifndef MR_NO_THREADS
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#endif
 
 #if defined(_WIN32)
 #include <Ws2tcpip.h>
 #include <winsock2.h>
 #else
 #include <netdb.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #endif
 
 #define RINGBUF_IMPLEMENTATION
 #include "mini-rocket.h"
 
+// Statistics, see minirocket_get_stats; build with -DMR_NO_STATS to drop them
+#ifndef MR_NO_STATS
+#define MR_STAT(x) x
+
+static long long _minirocket_now_us(void)
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec * 1000000LL + t.tv_usec;
+}
+#else
+#define MR_STAT(x)
+typedef struct __minirocket_stats_t minirocket_stats_t;
+#endif
+
+/**
+ * Compressed tracks (see minirocket_compress) keep their keys in blocks of
+ * MR_PACK_BLOCK. Each key is a varint of its row delta from the previous
+ * key shifted left by 2 and or'ed with its interpolation, followed by its
+ * value: a float, or a 16-bit step from the block's base in quantized
+ * blocks. The block index gives the first row and data offset of every
+ * block, so a lookup only ever decodes one block.
+ */
+typedef struct {
+  unsigned int	 row;     // of the first key
+  unsigned int	 offset;  // of the first key's bytes in data
+  float		 base;    // value = base + q * scale in quantized blocks
+  float		 scale;
+  bool		 quantized;
+} mrocket_block_t;
+
+// One decoded block plus the first key of the next block
+typedef struct {
+  unsigned int	 block;    // numblocks while empty
+  unsigned int	 numkeys;  // including the next block's first key
+  mrocket_key_t	 keys[MR_PACK_BLOCK + 1];
+  mrocket_seg_t	 segs[MR_PACK_BLOCK + 1];  // compiled on first use
+  bool		 compiled[MR_PACK_BLOCK + 1];
+} mrocket_unpacked_t;
+
+// A playhead's decoded block of one packing of a track
+typedef struct __mrocket_blockcache_t {
+  const mrocket_track_t *track;  // NULL while unused
+  unsigned int	 packing;        // track->packings when it was decoded
+  mrocket_unpacked_t unpacked;
+} mrocket_blockcache_t;
+
+typedef struct __mrocket_packed_t {
+  unsigned int	 numblocks;
+  size_t	 size;   // of the whole allocation, index and data included
+  mrocket_unpacked_t *cache;
+  unsigned char	*data;
+  mrocket_block_t blocks[];
+} mrocket_packed_t;
+
+// Decodes keys [first, first + n) of block b into keys
+static void _minirocket_unpack_block(const mrocket_packed_t *packed, unsigned int b, unsigned int first, unsigned int n, mrocket_key_t *keys)
+{
+  const mrocket_block_t *block = &packed->blocks[b];
+  const unsigned char *p = packed->data + block->offset;
+  unsigned int row = block->row;
+  for(unsigned int i=0; i < first + n; i++) {
+    uint64_t v = 0;
+    int shift = 0;
+    do {
+      v |= (uint64_t)(*p & 0x7f) << shift;
+      shift += 7;
+    } while(*p++ & 0x80);
+    row += (unsigned int)(v >> 2);
+    float value;
+    if(block->quantized) {
+      value = block->base + (float)(p[0] | (p[1] << 8)) * block->scale;
+      p += 2;
+    } else {
+      memcpy(&value, p, sizeof(float));
+      p += sizeof(float);
+    }
+    if(i >= first) {
+      mrocket_key_t *key = &keys[i - first];
+      key->row = row;
+      key->value = value;
+      key->interp = v & 3;
+      key->p1 = key->p2 = key->p3 = 0;
+    }
+  }
+}
+
+// Copies keys [first, first + n) of a track, packed or not, into keys
+static void _minirocket_copy_keys(const mrocket_track_t *track, unsigned int first, unsigned int n, mrocket_key_t *keys)
+{
+  if(track->packed == NULL) {
+    memcpy(keys, track->keys + first, n * sizeof(mrocket_key_t));
+    return;
+  }
+  while(n > 0) {
+    unsigned int b = first / MR_PACK_BLOCK, offset = first % MR_PACK_BLOCK;
+    unsigned int count = MR_PACK_BLOCK - offset < n ? MR_PACK_BLOCK - offset : n;
+    _minirocket_unpack_block(track->packed, b, offset, count, keys);
+    keys += count;
+    first += count;
+    n -= count;
+  }
+}
+
 void minirocket_dump_to_file(mrocket_t *rocket, FILE *fd)
 {
+  mrocket_key_t chunk[MR_PACK_BLOCK];
+  if(rocket->pager != NULL) {
+    fprintf(stderr, "minirocket: paged timelines only hold one window and cannot be written\n");
+    return;
+  }
   for(unsigned int i=0; i < rocket->numtracks; i++) {
     mrocket_track_t *track = rocket->tracks[i];
     fprintf(fd, "#%s\n", track->name);
-    for(unsigned int j=0; j < track->numkeys; j++) {
-      mrocket_key_t *key = &track->keys[j];
-      fprintf(fd, "%d %.6f %d\n", key->row, key->value, key->interp);
+    for(unsigned int j=0; j < track->numkeys; j += MR_PACK_BLOCK) {
+      unsigned int n = track->numkeys - j < MR_PACK_BLOCK ? track->numkeys - j : MR_PACK_BLOCK;
+      _minirocket_copy_keys(track, j, n, chunk);
+      for(unsigned int k=0; k < n; k++) {
+	fprintf(fd, "%d %.6f %d\n", chunk[k].row, chunk[k].value, chunk[k].interp);
+      }
     }
   }
 }
 
+/**
+ * Time is kept as integer nanoseconds and rows as 32.32 fixed point. The
+ * conversion factors are derived once per tempo: rows_per_ns is rows per
+ * ns scaled by 2^64 and ns_per_row is ns per row scaled by 2^32, both
+ * rounded up so that row2ns(row) always converts back to at least row.
+ * bpm and rows_per_beat may still be written directly; the factors are
+ * recomputed the next time they are needed.
+ */
+#define MR_NS_PER_MINUTE 60000000000ULL
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 mrocket_u128_t;
+#endif
+
+// Brings the factors in tempo up to date with bpm and rows_per_beat
+static const mrocket_tempo_t *_minirocket_tempo(mrocket_tempo_t *tempo, int bpm, int rows_per_beat)
+{
+  if(bpm == tempo->bpm && rows_per_beat == tempo->rows_per_beat) {
+    return tempo;
+  }
+  tempo->bpm = bpm;
+  tempo->rows_per_beat = rows_per_beat;
+  long long rpm = (long long)bpm * rows_per_beat;
+  if(rpm <= 0) {
+    tempo->rows_per_ns = tempo->ns_per_row = 0;
+    return tempo;
+  }
+#if defined(__SIZEOF_INT128__)
+  tempo->rows_per_ns = (uint64_t)((((mrocket_u128_t)rpm << 64) + MR_NS_PER_MINUTE - 1) / MR_NS_PER_MINUTE);
+  tempo->ns_per_row = (uint64_t)((((mrocket_u128_t)MR_NS_PER_MINUTE << 32) + rpm - 1) / rpm);
+#else
+  tempo->rows_per_ns = (uint64_t)ceil(ldexp((double)rpm / MR_NS_PER_MINUTE, 64));
+  tempo->ns_per_row = (uint64_t)ceil(ldexp((double)MR_NS_PER_MINUTE / rpm, 32));
+#endif
+  return tempo;
+}
+
+// Row at time ns as 32.32 fixed point, saturating at the last row
+static uint64_t _minirocket_ns2rowfp(const mrocket_tempo_t *tempo, uint64_t ns)
+{
+#if defined(__SIZEOF_INT128__)
+  mrocket_u128_t rowfp = ((mrocket_u128_t)ns * tempo->rows_per_ns) >> 32;
+  return rowfp > UINT64_MAX ? UINT64_MAX : (uint64_t)rowfp;
+#else
+  double rowfp = ldexp((double)ns * (double)tempo->rows_per_ns, -32);
+  return rowfp >= 18446744073709551615.0 ? UINT64_MAX : (uint64_t)rowfp;
+#endif
+}
+
+static uint64_t _minirocket_row2ns(const mrocket_tempo_t *tempo, unsigned int row)
+{
+#if defined(__SIZEOF_INT128__)
+  return (uint64_t)(((mrocket_u128_t)row * tempo->ns_per_row + 0xffffffffu) >> 32);
+#else
+  return (uint64_t)ceil(ldexp((double)row * (double)tempo->ns_per_row, -32));
+#endif
+}
+
+// 32.32 row as a fraction and as the row it is in
+static double _minirocket_rowfp2rowf(uint64_t rowfp, unsigned int *row)
+{
+  *row = rowfp >> 32 > 0xffffffffu ? 0xffffffffu : (unsigned int)(rowfp >> 32);
+  return ldexp((double)rowfp, -32);
+}
+
+void minirocket_set_tempo(mrocket_t *rocket, int bpm, int rows_per_beat)
+{
+  rocket->bpm = bpm;
+  rocket->rows_per_beat = rows_per_beat;
+  _minirocket_tempo(&rocket->tempo, bpm, rows_per_beat);
+}
+
+uint64_t minirocket_ns2rowfp(mrocket_t *rocket, uint64_t ns)
+{
+  return _minirocket_ns2rowfp(_minirocket_tempo(&rocket->tempo, rocket->bpm, rocket->rows_per_beat), ns);
+}
+
+uint64_t minirocket_row2ns(mrocket_t *rocket, unsigned int row)
+{
+  return _minirocket_row2ns(_minirocket_tempo(&rocket->tempo, rocket->bpm, rocket->rows_per_beat), row);
+}
+
+void minirocket_set_time_ns(mrocket_t *rocket, uint64_t ns)
+{
+  rocket->time_ns = ns;
+  rocket->time = rocket->time_seen = (float)(ns / 1e6);
+}
+
+// Adopts a new value written to the millisecond time field since last seen
+static void _minirocket_sync_time(mrocket_t *rocket)
+{
+  if(rocket->time != rocket->time_seen) {
+    rocket->time_ns = rocket->time > 0.0f ? (uint64_t)((double)rocket->time * 1e6 + 0.5) : 0;
+    rocket->time_seen = rocket->time;
+  }
+}
+
+// Current row as a fraction and as the row it is in
+static double _minirocket_rowf(mrocket_t *rocket, unsigned int *row)
+{
+  _minirocket_sync_time(rocket);
+  return _minirocket_rowfp2rowf(minirocket_ns2rowfp(rocket, rocket->time_ns), row);
+}
+
+// Half a millisecond into the row, so that time2row() maps it back to row
 float minirocket_row2time(mrocket_t *rocket, unsigned long row) 
 {
-  const float rps = rocket->bpm / 60.0f * rocket->rows_per_beat;
-  const float newtime = ((float)(row)) / rps;
-  return newtime * 1000.0f + 0.5f;
+  return (float)(minirocket_row2ns(rocket, row) / 1e6) + 0.5f;
 }
 
 float minirocket_time2rowf(mrocket_t *rocket, float time) 
 {
-  const float rps = rocket->bpm / 60.0f * rocket->rows_per_beat;
-  const float row = rps * ((float)time) * 1.0f / 1000.0f;
-  return row;
+  uint64_t ns = time > 0.0f ? (uint64_t)((double)time * 1e6 + 0.5) : 0;
+  return (float)ldexp((double)minirocket_ns2rowfp(rocket, ns), -32);
 }
 
 unsigned int minirocket_time2row(mrocket_t *rocket, float time) 
 {
-  return (unsigned int)(floor(minirocket_time2rowf(rocket, time)));
+  uint64_t ns = time > 0.0f ? (uint64_t)((double)time * 1e6 + 0.5) : 0;
+  uint64_t row = minirocket_ns2rowfp(rocket, ns) >> 32;
+  return row > 0xffffffffu ? 0xffffffffu : (unsigned int)row;
 }
 
 static mrocket_t *mrocket_init() {
@@ -56,8 +288,16 @@ static mrocket_t *mrocket_init() {
   if(r == NULL) {
     return NULL;
   }
+  memset(r, 0, sizeof(mrocket_t));
+#ifndef MR_NO_THREADS
+  atomic_init(&r->refs, 1);
+#else
+  r->refs = 1;
+#endif
   r->paused = true;
   r->numtracks = 0;
+  r->maxtracks = 0;
+  r->tracks = NULL;
 #ifndef MR_NO_NETWORK
   r->sock = -1;
 #endif
@@ -67,10 +307,28 @@ static mrocket_t *mrocket_init() {
 }
 
 #ifndef MR_NO_NETWORK
-mrocket_t *minirocket_connect(const char *hostname, int port) {
+/**
+ * Starts an editor session on an already connected socket, e.g. one end
+ * of a socketpair. The rocket owns sock from here on.
+ */
+mrocket_t *minirocket_connect_fd(int sock) {
   mrocket_t *r = mrocket_init();
-  r->buf = ringbuf_create(512);
+  r->buf = ringbuf_create(MR_RINGBUF_SIZE);
   r->handshake = 12;
+  r->outrow = -1;
+  r->sock = sock;
+
+  if (send(r->sock, "hello, synctracker!", 19, 0) == -1){
+    perror("send hello");
+    return NULL;//exit(5);
+  }
+  FD_ZERO(&r->fds);
+  FD_SET(r->sock, &r->fds);
+  return r;
+}
+
+mrocket_t *minirocket_connect(const char *hostname, int port) {
+  int sock;
 
 #if __WIN32__
   int iResult;
@@ -91,423 +349,3797 @@ mrocket_t *minirocket_connect(const char *hostname, int port) {
   struct sockaddr_in server = {.sin_family      = AF_INET,
 			       .sin_port        = htons(port),
 			       .sin_addr.s_addr = *((unsigned long *)hostent->h_addr) };
-  if ((r->sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+  if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
     perror("socket");
     return NULL;
   }
 
-  if (connect(r->sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
+  if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
     perror("connect");
     return NULL;
   }
 
-  if (send(r->sock, "hello, synctracker!", 19, 0) == -1){
-    perror("send hello");
-    return NULL;//exit(5);
-  }
-  FD_ZERO(&r->fds);
-  FD_SET(r->sock, &r->fds);
-  return r;
+  return minirocket_connect_fd(sock);
 }
 
-void minirocket_disconnect(mrocket_t *r) {
-#if defined(_WIN32)
-    closesocket(r->sock);
-#else
-    close(r->sock);
+/**
+ * Decoded editor command, or an outgoing one when name/pause are used.
+ */
+typedef struct {
+  unsigned char	 cmd;       // CMD_*
+  unsigned char	 interp;
+  unsigned char	 pause;
+  unsigned int	 track;
+  unsigned int	 row;
+  float		 value;
+  const char	*name;      // CMD_GET_TRACK, points to the track name
+#ifndef MR_NO_STATS
+  long long	 arrival;   // us, when its last byte was read
 #endif
-  free(r);
+} mrocket_cmd_t;
+
+#ifndef MR_NO_THREADS
+/**
+ * Bounded single-producer single-consumer queue. head is only written by
+ * the consumer and tail by the producer, each on its own cache line.
+ */
+typedef struct {
+  mrocket_cmd_t	*cmds;
+  unsigned int	 mask;
+  char		 pad0[64];
+  atomic_uint	 head;
+  char		 pad1[64];
+  atomic_uint	 tail;
+  char		 pad2[64];
+} mrocket_queue_t;
+
+struct __mrocket_io_t {
+  pthread_t	  thread;
+  atomic_bool	  stop;
+  atomic_bool	  closed;
+#ifndef MR_NO_STATS
+  // network counters while the thread owns the socket, see MR_STAT_NET
+  atomic_ullong	  bytes_received;
+  atomic_ullong	  bytes_sent;
+  atomic_ullong	  syscalls;
+  atomic_ullong	  commands[CMD_SAVE_TRACKS+1];
+  atomic_ullong	  protocol_errors;
+  atomic_uint	  ringbuf_peak;
+#endif
+  mrocket_queue_t in;    // editor -> render thread
+  mrocket_queue_t out;   // render thread -> editor
+};
+
+static bool _minirocket_queue_init(mrocket_queue_t *q, unsigned int size) {
+  q->cmds = malloc(size * sizeof(mrocket_cmd_t));
+  q->mask = size - 1;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  return q->cmds != NULL;
 }
 
-void minirocket_socket_send_pause(mrocket_t *rocket, unsigned int pause)
-{
-  if(rocket->sock <= 0) {
-    return;
+static bool _minirocket_queue_full(mrocket_queue_t *q) {
+  unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  return tail - atomic_load_explicit(&q->head, memory_order_acquire) > q->mask;
+}
+
+static bool _minirocket_queue_push(mrocket_queue_t *q, const mrocket_cmd_t *cmd) {
+  unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  if(tail - atomic_load_explicit(&q->head, memory_order_acquire) > q->mask) {
+    return false;
   }
-  const char head[2] = {CMD_PAUSE, pause};
+  q->cmds[tail & q->mask] = *cmd;
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return true;
+}
 
-  if (send(rocket->sock, head, 2, 0) == -1){
-    perror("minirocket_socket_send_pause");
+static bool _minirocket_queue_pop(mrocket_queue_t *q, mrocket_cmd_t *cmd) {
+  unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  if(head == atomic_load_explicit(&q->tail, memory_order_acquire)) {
+    return false;
   }
+  *cmd = q->cmds[head & q->mask];
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return true;
 }
 
-void minirocket_socket_send_set_row(mrocket_t *rocket, unsigned int row)
-{
-  if(rocket->sock <= 0) {
-    return;
+#ifndef MR_NO_STATS
+// Adds the I/O thread's network counters to stats
+static void _minirocket_io_stats(struct __mrocket_io_t *io, minirocket_stats_t *stats) {
+  stats->bytes_received += atomic_load_explicit(&io->bytes_received, memory_order_relaxed);
+  stats->bytes_sent += atomic_load_explicit(&io->bytes_sent, memory_order_relaxed);
+  stats->syscalls += atomic_load_explicit(&io->syscalls, memory_order_relaxed);
+  for(int i=0; i <= CMD_SAVE_TRACKS; i++) {
+    stats->commands[i] += atomic_load_explicit(&io->commands[i], memory_order_relaxed);
   }
-  assert((int)row >= 0);
-  const char head[5] = {CMD_SET_ROW, 
-			(row>>24)&0xff,  (row>>16)&0xff, (row>>8)&0xff, row&0xff};
+  stats->protocol_errors += atomic_load_explicit(&io->protocol_errors, memory_order_relaxed);
+  unsigned int peak = atomic_load_explicit(&io->ringbuf_peak, memory_order_relaxed);
+  stats->ringbuf_peak = peak > stats->ringbuf_peak ? peak : stats->ringbuf_peak;
+}
+#endif
 
-  if (send(rocket->sock, head, 5, 0) == -1){
-    perror("minirocket_socket_send_set_row");
+static void _minirocket_stop_io_thread(mrocket_t *rocket) {
+  if(rocket->io == NULL) {
+    return;
   }
+  atomic_store(&rocket->io->stop, true);
+  pthread_join(rocket->io->thread, NULL);
+  MR_STAT(_minirocket_io_stats(rocket->io, &rocket->stats));
+  free(rocket->io->in.cmds);
+  free(rocket->io->out.cmds);
+  free(rocket->io);
+  rocket->io = NULL;
+}
+#endif
+
+/**
+ * CMD_SAVE_TRACKS copies the names and keys of every track into one
+ * snapshot and leaves formatting and writing it to a background thread, so
+ * the tick never waits for the disk. The text is written through a large
+ * stdio buffer to path.tmp, which is renamed over path once complete.
+ */
+#define MR_SAVE_BUFFER (1 << 20)
 
+typedef struct __mrocket_save_t {
+  char		 *path;
+  unsigned int	 numtracks;
+  unsigned int	 *start;  // first key of each track in keys, numtracks + 1 entries
+  char		 *names;  // NUL-terminated, in track order
+  mrocket_key_t	 *keys;
+} mrocket_save_t;
+
+static void _minirocket_save_free(mrocket_save_t *save)
+{
+  free(save->path);
+  free(save->start);
+  free(save->names);
+  free(save->keys);
+  free(save);
 }
 
-static bool _minirocket_socket_send_get_track(mrocket_t *rocket, const char *name) 
+static mrocket_save_t *_minirocket_save_snapshot(mrocket_t *rocket, const char *path)
 {
-  if(rocket->sock <= 0) {
-    fprintf(stderr, "minirocket_socket_send_get_track: no socket"); fflush(stderr); fflush(stdout);
-    return false;
+  size_t namelen = 0, pathlen = strlen(path);
+  unsigned int numkeys = 0;
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    namelen += strlen(rocket->tracks[i]->name) + 1;
+    numkeys += rocket->tracks[i]->numkeys;
+  }
+  mrocket_save_t *save = calloc(1, sizeof(mrocket_save_t));
+  if(save == NULL) {
+    return NULL;
+  }
+  save->path = malloc(pathlen + 1);
+  save->start = malloc((rocket->numtracks + 1) * sizeof(unsigned int));
+  save->names = malloc(namelen + 1);
+  save->keys = malloc(numkeys * sizeof(mrocket_key_t) + 1);
+  if(save->path == NULL || save->start == NULL || save->names == NULL || save->keys == NULL) {
+    _minirocket_save_free(save);
+    return NULL;
   }
-  unsigned int len = strlen(name);
-  const char head[5] = {CMD_GET_TRACK, 
-			(len>>24)&0xff,  (len>>16)&0xff, (len>>8)&0xff, len&0xff};
+  memcpy(save->path, path, pathlen + 1);
+  save->numtracks = rocket->numtracks;
 
-  if (send(rocket->sock, head, 5, 0) == -1){
-    perror("minirocket_socket_send_get_track: send cmd"); fflush(stderr); fflush(stdout);
-    return false;
+  char *name = save->names;
+  unsigned int k = 0;
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    size_t len = strlen(track->name) + 1;
+    memcpy(name, track->name, len);
+    name += len;
+    save->start[i] = k;
+    _minirocket_copy_keys(track, 0, track->numkeys, save->keys + k);
+    k += track->numkeys;
   }
+  save->start[rocket->numtracks] = k;
+  return save;
+}
 
-  if (send(rocket->sock, name, len, 0) == -1){
-    perror("minirocket_socket_send_get_track: send name"); fflush(stderr); fflush(stdout);
+static bool _minirocket_save_write(const mrocket_save_t *save)
+{
+  size_t len = strlen(save->path);
+  char *tmp = malloc(len + 5);
+  if(tmp == NULL) {
+    fprintf(stderr, "minirocket: out of memory saving %s\n", save->path);
+    return false;
+  }
+  memcpy(tmp, save->path, len);
+  memcpy(tmp + len, ".tmp", 5);
+  FILE *fd = fopen(tmp, "w");
+  if(fd == NULL) {
+    perror(tmp);
+    free(tmp);
     return false;
   }
+  setvbuf(fd, NULL, _IOFBF, MR_SAVE_BUFFER);
 
-  return true;
+  const char *name = save->names;
+  for(unsigned int i=0; i < save->numtracks; i++) {
+    fprintf(fd, "#%s\n", name);
+    name += strlen(name) + 1;
+    for(unsigned int k = save->start[i]; k < save->start[i+1]; k++) {
+      fprintf(fd, "%d %.6f %d\n", save->keys[k].row, save->keys[k].value, save->keys[k].interp);
+    }
+  }
+  bool ok = fflush(fd) == 0 && !ferror(fd);
+#if !defined(_WIN32)
+  // the data must be on disk before the rename makes it the saved file
+  ok = ok && fsync(fileno(fd)) == 0;
+#endif
+  ok = fclose(fd) == 0 && ok;
+#if defined(_WIN32)
+  if(ok) {
+    remove(save->path);  // rename does not replace files here
+  }
+#endif
+  if(ok && rename(tmp, save->path) != 0) {
+    perror(save->path);
+    ok = false;
+  }
+  if(!ok) {
+    fprintf(stderr, "minirocket: failed to save %s\n", save->path);
+    remove(tmp);
+  }
+  free(tmp);
+  return ok;
 }
 
+#ifndef MR_NO_THREADS
+typedef struct __mrocket_saver_t {
+  pthread_t	 thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  mrocket_save_t *pending;  // next snapshot to write, replaced by newer saves
+  bool		 quit;
+} mrocket_saver_t;
 
-static int _minirocket_socket_ringbuf_read(mrocket_t *rocket, int max_bytes) {
-  struct timeval to = {0, 0};
-
-  FD_SET(rocket->sock, &rocket->fds);
-
-  if(select((int)rocket->sock + 1, &rocket->fds, NULL, NULL, &to) <= 0) {
-    return ringbuf_size(rocket->buf);
-  }
-
-  unsigned char buf[max_bytes];
-  int numbytes;
-  /**
-   *   0 1 2 3 4 5 6 7 8 9
-   *                     w
-   *                   r
-   *
-   */
-  int max = rocket->buf->max - rocket->buf->size;
-  max = max > max_bytes ? max_bytes : max;
-  //  fprintf(stderr, "ringbuf_read max %d bytes\n", max);
-  
-  if(max <= 0) {
-    ringbuf_print(rocket->buf);
-    return ringbuf_size(rocket->buf);
-  }
-  assert(max > 0);
-  if ((numbytes=recv(rocket->sock, (char *)buf, max, 0x0)) == -1) {
-    if(errno != EAGAIN && errno != 0) {
-      perror("recv"); fflush(stderr);
-      return -1;
+static void *_minirocket_saver_thread(void *arg)
+{
+  mrocket_saver_t *saver = arg;
+  pthread_mutex_lock(&saver->lock);
+  for(;;) {
+    if(saver->pending != NULL) {
+      mrocket_save_t *save = saver->pending;
+      saver->pending = NULL;
+      pthread_mutex_unlock(&saver->lock);
+      if(_minirocket_save_write(save)) {
+	fprintf(stderr, "minirocket: saved to file '%s'!\n", save->path); fflush(stderr);
+      }
+      _minirocket_save_free(save);
+      pthread_mutex_lock(&saver->lock);
+    } else if(saver->quit) {
+      break;
+    } else {
+      pthread_cond_wait(&saver->cond, &saver->lock);
     }
   }
-  else if(numbytes > 0) {
-    ringbuf_write(rocket->buf, buf, numbytes);
-  }
-
-  return ringbuf_size(rocket->buf);
+  pthread_mutex_unlock(&saver->lock);
+  return NULL;
 }
 
-#endif // #ifndef MR_NO_NETWORK
-
-static int _mrocket_track_sort_compare(const void *a, const void *b) {
-  mrocket_key_t *k1 = (mrocket_key_t *)a;
-  mrocket_key_t *k2 = (mrocket_key_t *)b;
-  return k1->row - k2->row;
+static mrocket_saver_t *_minirocket_saver_start(void)
+{
+  mrocket_saver_t *saver = calloc(1, sizeof(mrocket_saver_t));
+  if(saver == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&saver->lock, NULL);
+  pthread_cond_init(&saver->cond, NULL);
+  if(pthread_create(&saver->thread, NULL, _minirocket_saver_thread, saver) != 0) {
+    pthread_cond_destroy(&saver->cond);
+    pthread_mutex_destroy(&saver->lock);
+    free(saver);
+    return NULL;
+  }
+  return saver;
 }
 
-static void _minirocket_sort_keys(mrocket_track_t *track) {
-  qsort(track->keys, track->numkeys, sizeof(mrocket_key_t), _mrocket_track_sort_compare);
+// Waits for the last requested save to be written
+static void _minirocket_saver_stop(mrocket_saver_t *saver)
+{
+  pthread_mutex_lock(&saver->lock);
+  saver->quit = true;
+  pthread_cond_signal(&saver->cond);
+  pthread_mutex_unlock(&saver->lock);
+  pthread_join(saver->thread, NULL);
+  pthread_cond_destroy(&saver->cond);
+  pthread_mutex_destroy(&saver->lock);
+  free(saver);
 }
+#endif
 
-mrocket_t *minirocket_read_from_file(const char *filename) 
+static void _minirocket_save(mrocket_t *rocket)
 {
-  FILE *fd = fopen(filename, "r");
-  if(fd == NULL) {
-    perror("fopen");
-    return NULL;
+  const char *path = rocket->save_path != NULL ? rocket->save_path : "demo.rkt";
+  mrocket_save_t *save = _minirocket_save_snapshot(rocket, path);
+  if(save == NULL) {
+    fprintf(stderr, "minirocket: out of memory saving %s\n", path);
+    return;
   }
-  mrocket_t *rocket = mrocket_init();
-
-  char buf[512];
-  mrocket_track_t *track = NULL;
-  while((fgets(buf, 512, fd) != NULL)) {
-    buf[strlen(buf)-1]=0; // trim newline
-    if(buf[0] == '#') { // track name
-      track = malloc(sizeof(mrocket_track_t));
-      memset(track, 0, sizeof(mrocket_track_t));
-      track->rocket = rocket;
-      track->numkeys = 0;
-      track->id = rocket->numtracks;
-      track->name = strdup(buf+1);
-      //      track->name[strlen(track->name)-1] = 0;
-      rocket->tracks[rocket->numtracks++] = track;
-    }
-    else {
-      assert(track != NULL);
-
-      char *b = buf;
-      mrocket_key_t *key = &track->keys[track->numkeys++];
-      key->row = atol(buf);
-      while(isalnum(*b++)) {}
-
-      key->value = (float)atof(b);
-      key->interp = (unsigned char)b[strlen(b)-1]-'0';
-      _minirocket_sort_keys(track);
+  fprintf(stderr, "minirocket: saving to file '%s'!\n", path); fflush(stderr);
+#ifndef MR_NO_THREADS
+  if(rocket->saver == NULL) {
+    rocket->saver = _minirocket_saver_start();
+  }
+  if(rocket->saver != NULL) {
+    mrocket_saver_t *saver = rocket->saver;
+    pthread_mutex_lock(&saver->lock);
+    if(saver->pending != NULL) {
+      _minirocket_save_free(saver->pending);  // not started yet, this one is newer
     }
+    saver->pending = save;
+    pthread_cond_signal(&saver->cond);
+    pthread_mutex_unlock(&saver->lock);
+    return;
   }
-  return rocket;
+#endif
+  if(_minirocket_save_write(save)) {
+    fprintf(stderr, "minirocket: saved to file '%s'!\n", path); fflush(stderr);
+  }
+  _minirocket_save_free(save);
 }
 
-
-bool minirocket_write_to_file(mrocket_t *rocket, const char *filename) 
+bool minirocket_set_save_path(mrocket_t *rocket, const char *path)
 {
-  FILE *fd = fopen(filename, "w");
-  if(fd == NULL) {
-    perror("fopen");
+  char *copy = malloc(strlen(path) + 1);
+  if(copy == NULL) {
+    fprintf(stderr, "minirocket: out of memory setting save path\n");
     return false;
   }
-  minirocket_dump_to_file(rocket, fd);
-
-  fclose(fd);
+  strcpy(copy, path);
+  free(rocket->save_path);
+  rocket->save_path = copy;
   return true;
 }
 
+/**
+ * Network counters belong to the thread that owns the socket: the render
+ * thread, or the I/O thread while it runs, which counts into relaxed
+ * atomics of its own that minirocket_get_stats() adds in.
+ */
+#if defined(MR_NO_STATS)
+#define MR_STAT_NET(rocket, field, n)
+#elif defined(MR_NO_THREADS)
+#define MR_STAT_NET(rocket, field, n) ((rocket)->stats.field += (n))
+#else
+#define MR_STAT_NET(rocket, field, n)					\
+  ((rocket)->io != NULL ?						\
+   (void)atomic_fetch_add_explicit(&(rocket)->io->field, (n), memory_order_relaxed) : \
+   (void)((rocket)->stats.field += (n)))
+#endif
 
-
-
-static void minirocket_delete_key(mrocket_t *rocket, 
-				  unsigned int track_no, 
-				  unsigned int row) {
-
-  assert(track_no <= rocket->numtracks);
-  mrocket_track_t *track = rocket->tracks[track_no];
-  for(unsigned int i=0; i < track->numkeys; i++) {
-    mrocket_key_t *key = &track->keys[i];
-    if(key->row == row) {
-      // Delete this key
-      memcpy(((char *)track->keys) + i * sizeof(mrocket_key_t),
-	     ((char *)track->keys) + (i+1) * sizeof(mrocket_key_t),
-	     (track->numkeys - i)* sizeof(mrocket_key_t));
-      track->numkeys--;
-      _minirocket_sort_keys(track);
-      return;
-    }
+static void _minirocket_socket_close(mrocket_t *rocket) {
+#ifndef MR_NO_THREADS
+  _minirocket_stop_io_thread(rocket);
+#endif
+  if(rocket->sock > 0) {
+#if defined(_WIN32)
+    closesocket(rocket->sock);
+#else
+    close(rocket->sock);
+#endif
   }
-  fprintf(stderr, "minirocket: FAILED delete key: %d %d  numkeys:%d~\n", track_no, row, track->numkeys); fflush(stderr);
-  assert(false);
+  rocket->sock = -1;
 }
 
-static void minirocket_set_key(mrocket_t *rocket, 
-			       unsigned int track_no, 
-			       unsigned int row, 
-			       float value, 
-			       unsigned char interp) 
+void minirocket_disconnect(mrocket_t *r) {
+  minirocket_flush(r);
+  _minirocket_socket_close(r);
+  free(r->outbuf);
+  ringbuf_free(r->buf);
+  r->buf = NULL;
+  minirocket_free(r);
+}
+
+static bool _minirocket_socket_reserve(mrocket_t *rocket, unsigned int size)
 {
-  if(track_no >= rocket->numtracks) {
-    fprintf(stderr, "minirocket: track_no %d is not valid. max %d \n", track_no, rocket->numtracks);
-    return;
+  if(rocket->outlen + size <= rocket->outmax) {
+    return true;
+  }
+  unsigned int outmax = rocket->outmax ? rocket->outmax : 256;
+  while(outmax < rocket->outlen + size) {
+    outmax *= 2;
+  }
+  unsigned char *outbuf = realloc(rocket->outbuf, outmax);
+  if(outbuf == NULL) {
+    fprintf(stderr, "minirocket: out of memory growing send buffer to %u\n", outmax);
+    return false;
   }
+  rocket->outbuf = outbuf;
+  rocket->outmax = outmax;
+  return true;
+}
 
-  mrocket_track_t *track = rocket->tracks[track_no];
+static void _minirocket_socket_put_long(unsigned char *p, unsigned int v)
+{
+  p[0] = (v>>24)&0xff;
+  p[1] = (v>>16)&0xff;
+  p[2] = (v>>8)&0xff;
+  p[3] = v&0xff;
+}
 
-  for(unsigned int i=0; i < track->numkeys; i++) {
-    mrocket_key_t *key = &track->keys[i];
-    if(key->row == row) {
-      key->value = value;
-      key->interp = interp;
-      return;
+/**
+ * Encodes an outgoing command into the send buffer, which is written to
+ * the socket by minirocket_flush(). Of consecutive row updates only the
+ * last matters to the editor, so a SET_ROW that is still the last command
+ * in the buffer is overwritten in place rather than appended again. Any
+ * other command ends that, keeping rows and pauses in order.
+ */
+static bool _minirocket_socket_send_cmd(mrocket_t *rocket, const mrocket_cmd_t *cmd)
+{
+  if(cmd->cmd != CMD_SET_ROW) {
+    rocket->outrow = -1;
+  }
+  switch(cmd->cmd) {
+  case CMD_PAUSE:
+    if(!_minirocket_socket_reserve(rocket, 2)) {
+      return false;
+    }
+    rocket->outbuf[rocket->outlen++] = CMD_PAUSE;
+    rocket->outbuf[rocket->outlen++] = cmd->pause;
+    return true;
+  case CMD_SET_ROW:
+    if(rocket->outrow >= 0) {
+      _minirocket_socket_put_long(rocket->outbuf + rocket->outrow + 1, cmd->row);
+      return true;
+    }
+    if(!_minirocket_socket_reserve(rocket, 5)) {
+      return false;
     }
+    rocket->outrow = rocket->outlen;
+    rocket->outbuf[rocket->outlen] = CMD_SET_ROW;
+    _minirocket_socket_put_long(rocket->outbuf + rocket->outlen + 1, cmd->row);
+    rocket->outlen += 5;
+    return true;
+  case CMD_GET_TRACK: {
+    unsigned int len = strlen(cmd->name);
+    if(!_minirocket_socket_reserve(rocket, 5 + len)) {
+      return false;
+    }
+    rocket->outbuf[rocket->outlen] = CMD_GET_TRACK;
+    _minirocket_socket_put_long(rocket->outbuf + rocket->outlen + 1, len);
+    memcpy(rocket->outbuf + rocket->outlen + 5, cmd->name, len);
+    rocket->outlen += 5 + len;
+    return true;
   }
-
-  // new key
-  mrocket_key_t *key = &track->keys[track->numkeys];
-  key->row = row;
-  key->value = value;
-  key->interp = interp;
-  track->numkeys++;
-  assert(track->numkeys < MR_MAX_KEYS);
-  _minirocket_sort_keys(track);
+  }
+  return false;
 }
 
-mrocket_track_t * minirocket_create_track(mrocket_t *rocket, const char *name) 
+static bool _minirocket_socket_flush(mrocket_t *rocket)
 {
-  for(unsigned int i=0; i < rocket->numtracks; i++) {
-    if(strcmp(name, rocket->tracks[i]->name) == 0) {
-      return rocket->tracks[i];
+  unsigned int sent = 0;
+  while(sent < rocket->outlen) {
+    int n = send(rocket->sock, (const char *)rocket->outbuf + sent, rocket->outlen - sent, 0);
+    MR_STAT_NET(rocket, syscalls, 1);
+    if(n == -1) {
+      if(errno == EINTR) {
+	continue;
+      }
+      perror("minirocket_flush");
+      break;
     }
+    sent += n;
   }
+  bool ok = sent == rocket->outlen;
+  MR_STAT_NET(rocket, bytes_sent, sent);
+  rocket->outlen = 0;
+  rocket->outrow = -1;
+  return ok;
+}
 
-#ifndef MR_NO_NETWORK
-  if(!_minirocket_socket_send_get_track(rocket, name)) {
-    fprintf(stderr, "rocket ERROR: could not send GET_TRACK\n"); fflush(stderr);
-    return NULL;
-  }
+bool minirocket_flush(mrocket_t *rocket)
+{
+  if(rocket->sock <= 0) {
+    return false;
+  }
+#ifndef MR_NO_THREADS
+  if(rocket->io != NULL) {
+    return true; // the I/O thread flushes after every batch it forwards
+  }
+#endif
+  return _minirocket_socket_flush(rocket);
+}
+
+/**
+ * Sends an outgoing command, or hands it to the I/O thread when one runs.
+ * A full queue drops row updates (the next row change supersedes them) but
+ * waits for room for anything else.
+ */
+static bool _minirocket_socket_submit(mrocket_t *rocket, const mrocket_cmd_t *cmd)
+{
+#ifndef MR_NO_THREADS
+  if(rocket->io != NULL) {
+    while(!_minirocket_queue_push(&rocket->io->out, cmd)) {
+      if(cmd->cmd == CMD_SET_ROW || atomic_load(&rocket->io->closed)) {
+	return false;
+      }
+      sched_yield();
+    }
+    return true;
+  }
+#endif
+  return _minirocket_socket_send_cmd(rocket, cmd);
+}
+
+void minirocket_socket_send_pause(mrocket_t *rocket, unsigned int pause)
+{
+  if(rocket->sock <= 0) {
+    return;
+  }
+  mrocket_cmd_t cmd = {.cmd = CMD_PAUSE, .pause = pause};
+  _minirocket_socket_submit(rocket, &cmd);
+}
+
+void minirocket_socket_send_set_row(mrocket_t *rocket, unsigned int row)
+{
+  if(rocket->sock <= 0) {
+    return;
+  }
+  assert((int)row >= 0);
+  mrocket_cmd_t cmd = {.cmd = CMD_SET_ROW, .row = row};
+  _minirocket_socket_submit(rocket, &cmd);
+}
+
+static bool _minirocket_socket_send_get_track(mrocket_t *rocket, const char *name) 
+{
+  if(rocket->sock <= 0) {
+    fprintf(stderr, "minirocket_socket_send_get_track: no socket"); fflush(stderr); fflush(stdout);
+    return false;
+  }
+  mrocket_cmd_t cmd = {.cmd = CMD_GET_TRACK, .name = name};
+  return _minirocket_socket_submit(rocket, &cmd);
+}
+
+
+/**
+ * Reads whatever the socket has ready into the ring buffer, up to its free
+ * space, waiting at most timeout_us for data. Returns the number of bytes
+ * read, 0 if the socket would block or the buffer is full, and -1 if the
+ * connection failed or was closed.
+ */
+#ifndef MR_NO_STATS
+// Marks when the bytes up to buf->write arrived, and tracks buffer use
+static void _minirocket_stats_read(mrocket_t *rocket, int numbytes)
+{
+  unsigned int size = ringbuf_size(rocket->buf);
+  MR_STAT_NET(rocket, bytes_received, numbytes);
+#ifndef MR_NO_THREADS
+  if(rocket->io != NULL) {
+    if(size > atomic_load_explicit(&rocket->io->ringbuf_peak, memory_order_relaxed)) {
+      atomic_store_explicit(&rocket->io->ringbuf_peak, size, memory_order_relaxed);
+    }
+  } else
+#endif
+  if(size > rocket->stats.ringbuf_peak) {
+    rocket->stats.ringbuf_peak = size;
+  }
+  unsigned int i = rocket->arrivals++ % MR_ARRIVAL_MARKS;
+  rocket->arrival_us[i] = _minirocket_now_us();
+  rocket->arrival_end[i] = rocket->buf->write;
+}
+
+// Counts a decoded command and stamps it with the read its last byte came in
+static void _minirocket_stats_decoded(mrocket_t *rocket, mrocket_cmd_t *cmd)
+{
+  if(cmd->cmd <= CMD_SAVE_TRACKS && cmd->cmd != CMD_GET_TRACK) {
+    MR_STAT_NET(rocket, commands[cmd->cmd], 1);
+  } else {
+    MR_STAT_NET(rocket, protocol_errors, 1);
+  }
+  unsigned int first = rocket->arrivals > MR_ARRIVAL_MARKS ? rocket->arrivals - MR_ARRIVAL_MARKS : 0;
+  cmd->arrival = 0;
+  for(unsigned int i=first; i < rocket->arrivals; i++) {
+    unsigned int mark = i % MR_ARRIVAL_MARKS;
+    cmd->arrival = rocket->arrival_us[mark];
+    if((int)(rocket->arrival_end[mark] - rocket->buf->read) >= 0) {
+      break;
+    }
+  }
+}
+#endif
+
+static int _minirocket_socket_ringbuf_read(mrocket_t *rocket, long timeout_us) {
+  struct timeval to = {timeout_us / 1000000, timeout_us % 1000000};
+
+  unsigned char *p1, *p2;
+  unsigned int n1, n2;
+  if(ringbuf_free_spans(rocket->buf, &p1, &n1, &p2, &n2) == 0) {
+    return 0;
+  }
+
+  FD_SET(rocket->sock, &rocket->fds);
+
+  MR_STAT_NET(rocket, syscalls, 1);
+  if(select((int)rocket->sock + 1, &rocket->fds, NULL, NULL, &to) <= 0) {
+    return 0;
+  }
+  MR_STAT_NET(rocket, syscalls, 1);
+
+  // Receive straight into the free space, both spans at once where possible
+#if defined(_WIN32)
+  int numbytes = recv(rocket->sock, (char *)p1, n1, 0x0);
+#else
+  struct iovec iov[2] = {{p1, n1}, {p2, n2}};
+  int numbytes = readv(rocket->sock, iov, n2 > 0 ? 2 : 1);
+#endif
+  if(numbytes == -1) {
+    if(errno != EAGAIN && errno != 0) {
+      perror("recv"); fflush(stderr);
+      return -1;
+    }
+    return 0;
+  }
+  if(numbytes == 0) {
+    fprintf(stderr, "minirocket: editor closed the connection\n"); fflush(stderr);
+    return -1;
+  }
+  ringbuf_commit(rocket->buf, numbytes);
+  MR_STAT(_minirocket_stats_read(rocket, numbytes));
+  return numbytes;
+}
+
+// Consumes the editor's greeting; true once it has been seen entirely
+static bool _minirocket_socket_handshake(mrocket_t *rocket)
+{
+  if(rocket->handshake > 0) {
+    unsigned int size = ringbuf_size(rocket->buf);
+    unsigned int skip = size > (unsigned int)rocket->handshake ? (unsigned int)rocket->handshake : size;
+    rocket->handshake -= skip;
+    ringbuf_skip(rocket->buf, skip);
+  }
+  return rocket->handshake == 0;
+}
+
+/**
+ * Decodes the command at the head of the ring buffer into cmd. Returns
+ * false if the buffer does not yet hold a complete command.
+ */
+static bool _minirocket_socket_decode(ringbuf_t *buf, mrocket_cmd_t *cmd)
+{
+  unsigned int size = ringbuf_size(buf);
+
+  if(size == 0) {
+    return false;
+  }
+
+  cmd->cmd = ringbuf_peek(buf);
+  switch(cmd->cmd) {
+  case CMD_PAUSE:
+    if(size < 2) {
+      return false;
+    }
+    ringbuf_skip(buf, 1);
+    cmd->pause = ringbuf_read_byte(buf);
+    break;
+  case CMD_SET_ROW:
+    if(size < 5) {
+      return false;
+    }
+    ringbuf_skip(buf, 1);
+    cmd->row = ringbuf_read_long(buf);
+    break;
+  case CMD_SET_KEY:
+    if(size < 14) {
+      return false;
+    }
+    ringbuf_skip(buf, 1);
+    cmd->track = ringbuf_read_long(buf);
+    cmd->row = ringbuf_read_long(buf);
+    cmd->value = ringbuf_read_float(buf);
+    cmd->interp = ringbuf_read_byte(buf);
+    break;
+  case CMD_DELETE_KEY:
+    if(size < 9) {
+      return false;
+    }
+    ringbuf_skip(buf, 1);
+    cmd->track = ringbuf_read_long(buf);
+    cmd->row = ringbuf_read_long(buf);
+    break;
+  case CMD_SAVE_TRACKS:
+    ringbuf_skip(buf, 1);
+    break;
+  default:
+    fprintf(stderr, "minirocket: protocol error: %d\n", cmd->cmd); fflush(stderr);
+    ringbuf_print(buf);
+    ringbuf_skip(buf, 1);
+    break;
+  }
+  return true;
+}
+
+#ifndef MR_NO_THREADS
+/**
+ * I/O thread: owns the socket and the ring buffer, forwards queued
+ * outgoing commands and pushes decoded editor commands to the render
+ * thread. It sleeps in select() for at most 1ms so outgoing commands are
+ * never held back longer than that.
+ */
+static void *_minirocket_io_thread(void *arg)
+{
+  mrocket_t *rocket = arg;
+  struct __mrocket_io_t *io = rocket->io;
+  mrocket_cmd_t cmd = {0};
+  bool pending = false;
+
+  while(!atomic_load_explicit(&io->stop, memory_order_relaxed)) {
+    while(_minirocket_queue_pop(&io->out, &cmd)) {
+      _minirocket_socket_send_cmd(rocket, &cmd);
+    }
+    if(rocket->outlen > 0 && !_minirocket_socket_flush(rocket)) {
+      atomic_store(&io->closed, true);
+      return NULL;
+    }
+
+    int r = _minirocket_socket_ringbuf_read(rocket, pending ? 0 : 1000);
+    if(r == -1) {
+      atomic_store(&io->closed, true);
+      return NULL;
+    }
+
+    if(_minirocket_socket_handshake(rocket)) {
+      while(!_minirocket_queue_full(&io->in) && _minirocket_socket_decode(rocket->buf, &cmd)) {
+	MR_STAT(_minirocket_stats_decoded(rocket, &cmd));
+	_minirocket_queue_push(&io->in, &cmd);
+      }
+    }
+
+    // The render thread is behind: leave the rest in the socket buffer
+    pending = _minirocket_queue_full(&io->in);
+    if(pending) {
+      usleep(100);
+    }
+  }
+  return NULL;
+}
+
+bool minirocket_start_io_thread(mrocket_t *rocket)
+{
+  if(rocket->sock <= 0 || rocket->io != NULL) {
+    return false;
+  }
+  struct __mrocket_io_t *io = calloc(1, sizeof(struct __mrocket_io_t));
+  if(io == NULL || !_minirocket_queue_init(&io->in, MR_QUEUE_SIZE) || !_minirocket_queue_init(&io->out, MR_QUEUE_SIZE)) {
+    fprintf(stderr, "minirocket: out of memory starting I/O thread\n");
+    if(io != NULL) {
+      free(io->in.cmds);
+      free(io->out.cmds);
+      free(io);
+    }
+    return false;
+  }
+  atomic_init(&io->stop, false);
+  atomic_init(&io->closed, false);
+  rocket->io = io;
+  if(pthread_create(&io->thread, NULL, _minirocket_io_thread, rocket) != 0) {
+    perror("minirocket_start_io_thread");
+    free(io->in.cmds);
+    free(io->out.cmds);
+    free(io);
+    rocket->io = NULL;
+    return false;
+  }
+  return true;
+}
+#endif
+
+#endif // #ifndef MR_NO_NETWORK
+
+#ifndef MR_NO_THREADS
+/**
+ * Snapshot mode, see minirocket_enable_snapshots. The tick thread keeps
+ * editing the tracks' own key arrays. minirocket_publish() copies the
+ * tracks edited since the last publish into immutable keysets and swaps in
+ * a new version (one keyset per track) with a single atomic store.
+ *
+ * Readers pin the current version by announcing the global epoch in their
+ * slot. Replaced versions and keysets are retired with the epoch they were
+ * replaced in, which is then advanced, and freed once every slot is idle
+ * or announces a later epoch.
+ */
+typedef struct __mrocket_garbage_t {
+  struct __mrocket_garbage_t *next;  // retired list
+  unsigned long	 epoch;              // epoch it was replaced in
+} mrocket_garbage_t;
+
+typedef struct {
+  mrocket_garbage_t gc;
+  unsigned int	 numkeys;
+  mrocket_seg_t	 *segs;  // numkeys segments, stored after keys
+  mrocket_key_t	 keys[];
+} mrocket_keyset_t;
+
+typedef struct {
+  mrocket_garbage_t gc;
+  unsigned int	 numtracks;
+  mrocket_keyset_t *keysets[];  // by track id, NULL for tracks without keys
+} mrocket_version_t;
+
+typedef struct {
+  atomic_ulong	 epoch;  // pinned epoch, 0 when idle
+  atomic_bool	 used;
+  char		 pad[64];
+} mrocket_slot_t;
+
+typedef struct __mrocket_rcu_t {
+  _Atomic(mrocket_version_t *) current;
+  atomic_ullong	 rowfp;    // 32.32 row of the last publish
+  atomic_ulong	 epoch;
+  char		 pad[64];
+  mrocket_slot_t slots[MR_MAX_READERS];
+  unsigned int	 *dirty;   // ids of tracks edited since the last publish
+  unsigned int	 numdirty;
+  unsigned int	 maxdirty;
+  mrocket_garbage_t *retired;
+} mrocket_rcu_t;
+
+struct __mrocket_reader_t {
+  mrocket_rcu_t	 *rcu;
+  mrocket_slot_t *slot;
+  mrocket_version_t *version;  // pinned version, NULL when not pinned
+  double	 rowf;
+  unsigned int	 row;
+};
+
+static void _minirocket_rcu_edited(mrocket_rcu_t *rcu, unsigned int id) {
+  if(rcu->numdirty == rcu->maxdirty) {
+    unsigned int maxdirty = rcu->maxdirty ? rcu->maxdirty * 2 : MR_MIN_TRACKS;
+    unsigned int *dirty = realloc(rcu->dirty, maxdirty * sizeof(unsigned int));
+    if(dirty == NULL) {
+      fprintf(stderr, "minirocket: out of memory recording edit of track %u\n", id);
+      return;
+    }
+    rcu->dirty = dirty;
+    rcu->maxdirty = maxdirty;
+  }
+  rcu->dirty[rcu->numdirty++] = id;
+}
+
+static void _minirocket_rcu_free(mrocket_rcu_t *rcu)
+{
+  mrocket_version_t *version = atomic_load(&rcu->current);
+  for(unsigned int i=0; i < version->numtracks; i++) {
+    free(version->keysets[i]);
+  }
+  free(version);
+  while(rcu->retired != NULL) {
+    mrocket_garbage_t *gc = rcu->retired;
+    rcu->retired = gc->next;
+    free(gc);
+  }
+  free(rcu->dirty);
+  free(rcu);
+}
+
+/**
+ * Evaluation pool, see minirocket_eval_all_parallel. The track table is
+ * cut into MR_POOL_CHUNKS chunks per thread of about equal cost, and each
+ * thread owns a contiguous run of chunks it takes from the front with an
+ * atomic counter. A thread that runs out takes chunks from the other
+ * threads' counters. Chunk boundaries fall on cache line boundaries of
+ * the output array so no two threads write the same line.
+ */
+#define MR_POOL_CHUNKS 8
+#define MR_POOL_LINE (64 / sizeof(float))
+
+typedef struct __mrocket_pool_t mrocket_pool_t;
+
+typedef struct {
+  mrocket_pool_t *pool;
+  unsigned int	 index;
+  atomic_uint	 next;  // next chunk to take
+  unsigned int	 end;   // end of this thread's run of chunks
+  char		 pad[64];
+} mrocket_worker_t;
+
+struct __mrocket_pool_t {
+  unsigned int	 requested;
+  unsigned int	 nthreads;       // started, including the calling thread
+  pthread_t	 *threads;
+  mrocket_worker_t *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  unsigned long	 generation;     // bumped for each frame, under lock
+  bool		 stop;
+  atomic_uint	 busy;           // pool threads still working on the frame
+  // current frame
+  mrocket_track_t **tracks;
+  float		 *out;
+  double	 rowf;
+  unsigned int	 row;
+  // chunk layout, recomputed when the table or output alignment changes
+  unsigned int	 numtracks;
+  unsigned int	 shift;
+  unsigned int	 *bounds;        // numchunks + 1 track indices
+  unsigned int	 numchunks;
+};
+
+static void _minirocket_pool_free(mrocket_pool_t *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for(unsigned int i=1; i < pool->nthreads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->bounds);
+  free(pool);
+}
+#endif
+
+static int _mrocket_track_sort_compare(const void *a, const void *b) {
+  mrocket_key_t *k1 = (mrocket_key_t *)a;
+  mrocket_key_t *k2 = (mrocket_key_t *)b;
+  return (k1->row > k2->row) - (k1->row < k2->row);
+}
+
+static void _minirocket_sort_keys(mrocket_track_t *track) {
+  for(unsigned int i=1; i < track->numkeys; i++) {
+    if(track->keys[i-1].row > track->keys[i].row) {
+      qsort(track->keys, track->numkeys, sizeof(mrocket_key_t), _mrocket_track_sort_compare);
+      return;
+    }
+  }
+}
+
+// Index of the first key at or after row
+static unsigned int _minirocket_lower_bound(mrocket_key_t *keys, unsigned int numkeys, unsigned int row) {
+  unsigned int lo = 0, hi = numkeys;
+  while(lo < hi) {
+    unsigned int mi = (lo + hi) >> 1;
+    if(keys[mi].row < row) {
+      lo = mi + 1;
+    } else {
+      hi = mi;
+    }
+  }
+  return lo;
+}
+
+// Called whenever the keys of a track change
+static void _minirocket_track_edited(mrocket_track_t *track) {
+  track->cursor = -1;
+  track->steadyfrom = 1;
+  track->steadylast = 0;
+  track->keysedited = true;
+  if(track->baked != NULL) {
+    free(track->baked);
+    track->baked = NULL;
+  }
+#ifndef MR_NO_THREADS
+  if(track->rocket->rcu != NULL) {
+    _minirocket_rcu_edited(track->rocket->rcu, track->id);
+  }
+#endif
+}
+
+// Polynomial of the segment starting at key i, see mrocket_seg_t
+static void _minirocket_compile_seg(mrocket_seg_t *seg, const mrocket_key_t *keys, unsigned int numkeys, unsigned int i)
+{
+  float a = keys[i].value;
+  float d = i + 1 < numkeys ? keys[i+1].value - a : 0.0f;
+  seg->row = keys[i].row;
+  seg->inv = i + 1 < numkeys ? 1.0f / (float)(keys[i+1].row - keys[i].row) : 0.0f;
+  seg->c[0] = a;
+  seg->c[1] = seg->c[2] = seg->c[3] = 0.0f;
+  switch(i + 1 < numkeys ? keys[i].interp : 0) {
+  case 0:
+    break;
+  case 1:
+    seg->c[1] = d;
+    break;
+  case 2:
+    seg->c[2] = 3.0f * d;
+    seg->c[3] = -2.0f * d;
+    break;
+  case 3:
+    seg->c[2] = d;
+    break;
+  default:
+    fprintf(stderr, "minirocket: key at row %u has unknown interpolation %d, using step\n", keys[i].row, keys[i].interp);
+  }
+}
+
+static bool _minirocket_segs_reserve(mrocket_track_t *track, unsigned int numsegs) {
+  if(numsegs <= track->maxsegs) {
+    return true;
+  }
+  unsigned int maxsegs = track->maxkeys > numsegs ? track->maxkeys : numsegs;
+  mrocket_seg_t *segs = realloc(track->segs, maxsegs * sizeof(mrocket_seg_t));
+  if(segs == NULL) {
+    fprintf(stderr, "minirocket: out of memory compiling track %s\n", track->name);
+    return false;
+  }
+  track->segs = segs;
+  track->maxsegs = maxsegs;
+  return true;
+}
+
+// Compiles every segment of the track on first use
+static bool _minirocket_track_segs(mrocket_track_t *track) {
+  if(track->segs != NULL) {
+    return true;
+  }
+  if(track->packed != NULL) {
+    return false;
+  }
+  if(!_minirocket_segs_reserve(track, track->numkeys)) {
+    return false;
+  }
+  for(unsigned int i=0; i < track->numkeys; i++) {
+    _minirocket_compile_seg(&track->segs[i], track->keys, track->numkeys, i);
+  }
+  return true;
+}
+
+/**
+ * Keeps compiled segments in step with a key inserted at (added 1), removed
+ * from (added -1) or changed at (added 0) index i of the key array. Only
+ * the segments ending and starting at i are recompiled.
+ */
+static void _minirocket_segs_edited(mrocket_track_t *track, unsigned int i, int added) {
+  if(track->segs == NULL) {
+    return;
+  }
+  if(!_minirocket_segs_reserve(track, track->numkeys)) {
+    free(track->segs);
+    track->segs = NULL;
+    track->maxsegs = 0;
+    return;
+  }
+  if(added > 0) {
+    memmove(&track->segs[i+1], &track->segs[i], (track->numkeys - i - 1) * sizeof(mrocket_seg_t));
+  } else if(added < 0) {
+    memmove(&track->segs[i], &track->segs[i+1], (track->numkeys - i) * sizeof(mrocket_seg_t));
+  }
+  unsigned int end = added < 0 ? i : i + 1;
+  for(unsigned int j = i > 0 ? i - 1 : 0; j < end && j < track->numkeys; j++) {
+    _minirocket_compile_seg(&track->segs[j], track->keys, track->numkeys, j);
+  }
+}
+
+// Expands a compressed track back into a key array
+static bool _minirocket_track_unpack(mrocket_track_t *track) {
+  unsigned int maxkeys = track->numkeys > MR_MIN_KEYS ? track->numkeys : MR_MIN_KEYS;
+  mrocket_key_t *keys = malloc(maxkeys * sizeof(mrocket_key_t));
+  if(keys == NULL) {
+    fprintf(stderr, "minirocket: out of memory expanding track %s\n", track->name);
+    return false;
+  }
+  _minirocket_copy_keys(track, 0, track->numkeys, keys);
+  free(track->packed->cache);
+  free(track->packed);
+  track->packed = NULL;
+  track->keys = keys;
+  track->maxkeys = maxkeys;
+  track->cursor = -1;
+  return true;
+}
+
+/**
+ * Tracks loaded by minirocket_read_binary() point straight into the mapped
+ * file (maxkeys == 0). Copy the keys to the heap before the first edit.
+ */
+
+static bool _minirocket_track_own(mrocket_track_t *track) {
+  if(track->packed != NULL) {
+    return _minirocket_track_unpack(track);
+  }
+  if(track->maxkeys != 0 || track->keys == NULL) {
+    return true;
+  }
+  unsigned int maxkeys = track->numkeys > MR_MIN_KEYS ? track->numkeys : MR_MIN_KEYS;
+  mrocket_key_t *keys = malloc(maxkeys * sizeof(mrocket_key_t));
+  if(keys == NULL) {
+    fprintf(stderr, "minirocket: out of memory copying track %s\n", track->name);
+    return false;
+  }
+  memcpy(keys, track->keys, track->numkeys * sizeof(mrocket_key_t));
+  track->keys = keys;
+  track->maxkeys = maxkeys;
+  return true;
+}
+
+static bool _minirocket_track_reserve(mrocket_track_t *track, unsigned int numkeys) {
+  if(!_minirocket_track_own(track)) {
+    return false;
+  }
+  if(numkeys <= track->maxkeys) {
+    return true;
+  }
+  unsigned int maxkeys = track->maxkeys ? track->maxkeys : MR_MIN_KEYS;
+  while(maxkeys < numkeys) {
+    maxkeys *= 2;
+  }
+  mrocket_key_t *keys = realloc(track->keys, maxkeys * sizeof(mrocket_key_t));
+  if(keys == NULL) {
+    fprintf(stderr, "minirocket: out of memory growing track %s to %u keys\n", track->name, maxkeys);
+    return false;
+  }
+  track->keys = keys;
+  track->maxkeys = maxkeys;
+  return true;
+}
+
+/**
+ * Track names are indexed by two open-addressed hash tables of the same
+ * power-of-two size, holding track or group index + 1 (0 marks an empty
+ * slot). Tracks of a group ("group:name") are chained through nextingroup.
+ */
+static unsigned int _minirocket_hash(const char *name, size_t len) {
+  unsigned int hash = 2166136261u;
+  for(size_t i=0; i < len; i++) {
+    hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static int _minirocket_lookup_track(mrocket_t *rocket, const char *name, size_t len, unsigned int hash) {
+  unsigned int mask = rocket->hashsize - 1;
+  for(unsigned int i = hash & mask; rocket->hashsize > 0; i = (i + 1) & mask) {
+    unsigned int slot = rocket->trackhash[i];
+    if(slot == 0) {
+      break;
+    }
+    mrocket_track_t *track = rocket->tracks[slot-1];
+    if(track->hash == hash && strncmp(track->name, name, len) == 0 && track->name[len] == 0) {
+      return slot - 1;
+    }
+  }
+  return -1;
+}
+
+static int _minirocket_lookup_group(mrocket_t *rocket, const char *name, size_t len, unsigned int hash) {
+  unsigned int mask = rocket->hashsize - 1;
+  for(unsigned int i = hash & mask; rocket->hashsize > 0; i = (i + 1) & mask) {
+    unsigned int slot = rocket->grouphash[i];
+    if(slot == 0) {
+      break;
+    }
+    mrocket_group_t *group = &rocket->groups[slot-1];
+    if(group->hash == hash && group->namelen == len && memcmp(group->name, name, len) == 0) {
+      return slot - 1;
+    }
+  }
+  return -1;
+}
+
+static void _minirocket_hash_insert(unsigned int *table, unsigned int size, unsigned int hash, unsigned int index) {
+  unsigned int i = hash & (size - 1);
+  while(table[i] != 0) {
+    i = (i + 1) & (size - 1);
+  }
+  table[i] = index + 1;
+}
+
+static bool _minirocket_rehash(mrocket_t *rocket, unsigned int size) {
+  unsigned int *trackhash = calloc(size, sizeof(unsigned int));
+  unsigned int *grouphash = calloc(size, sizeof(unsigned int));
+  if(trackhash == NULL || grouphash == NULL) {
+    fprintf(stderr, "minirocket: out of memory growing track name table to %u\n", size);
+    free(trackhash);
+    free(grouphash);
+    return false;
+  }
+  free(rocket->trackhash);
+  free(rocket->grouphash);
+  rocket->trackhash = trackhash;
+  rocket->grouphash = grouphash;
+  rocket->hashsize = size;
+
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    if(_minirocket_lookup_track(rocket, track->name, strlen(track->name), track->hash) < 0) {
+      _minirocket_hash_insert(trackhash, size, track->hash, i);
+    }
+  }
+  for(unsigned int i=0; i < rocket->numgroups; i++) {
+    _minirocket_hash_insert(grouphash, size, rocket->groups[i].hash, i);
+  }
+  return true;
+}
+
+/**
+ * Adds a track that was just appended to rocket->tracks to the name and
+ * group index. The first track registered under a name wins lookups.
+ */
+static void _minirocket_register_track(mrocket_t *rocket, mrocket_track_t *track) {
+  size_t len = strlen(track->name);
+  track->hash = _minirocket_hash(track->name, len);
+  track->group = track->nextingroup = MR_NO_TRACK;
+
+  if(rocket->numtracks * 2 > rocket->hashsize &&
+     !_minirocket_rehash(rocket, rocket->hashsize ? rocket->hashsize * 2 : MR_MIN_TRACKS * 2) &&
+     rocket->numtracks >= rocket->hashsize) {
+    return;
+  }
+  if(_minirocket_lookup_track(rocket, track->name, len, track->hash) < 0) {
+    _minirocket_hash_insert(rocket->trackhash, rocket->hashsize, track->hash, track->id);
+  }
+
+  const char *colon = memchr(track->name, ':', len);
+  size_t grouplen = colon ? (size_t)(colon - track->name) : 0;
+  unsigned int grouphash = _minirocket_hash(track->name, grouplen);
+  int g = _minirocket_lookup_group(rocket, track->name, grouplen, grouphash);
+  if(g < 0) {
+    if(rocket->numgroups == rocket->maxgroups) {
+      unsigned int maxgroups = rocket->maxgroups ? rocket->maxgroups * 2 : MR_MIN_TRACKS;
+      mrocket_group_t *groups = realloc(rocket->groups, maxgroups * sizeof(mrocket_group_t));
+      if(groups == NULL) {
+	fprintf(stderr, "minirocket: out of memory growing group table to %u\n", maxgroups);
+	return;
+      }
+      rocket->groups = groups;
+      rocket->maxgroups = maxgroups;
+    }
+    g = rocket->numgroups++;
+    mrocket_group_t *group = &rocket->groups[g];
+    group->name = track->name;
+    group->namelen = grouplen;
+    group->hash = grouphash;
+    group->first = group->last = track->id;
+    group->numtracks = 0;
+    _minirocket_hash_insert(rocket->grouphash, rocket->hashsize, grouphash, g);
+  } else {
+    rocket->tracks[rocket->groups[g].last]->nextingroup = track->id;
+  }
+  mrocket_group_t *group = &rocket->groups[g];
+  group->last = track->id;
+  group->numtracks++;
+  track->group = g;
+  track->nextingroup = MR_NO_TRACK;
+}
+
+mrocket_track_t *minirocket_find_track(mrocket_t *rocket, const char *name) {
+  int i = _minirocket_lookup_track(rocket, name, strlen(name), _minirocket_hash(name, strlen(name)));
+  return i < 0 ? NULL : rocket->tracks[i];
+}
+
+unsigned int minirocket_get_group(mrocket_t *rocket, const char *group, mrocket_track_t **tracks, unsigned int max) {
+  size_t len = strlen(group);
+  int g = _minirocket_lookup_group(rocket, group, len, _minirocket_hash(group, len));
+  if(g < 0) {
+    return 0;
+  }
+  unsigned int n = 0;
+  for(unsigned int i = rocket->groups[g].first; i != MR_NO_TRACK && n < max; i = rocket->tracks[i]->nextingroup) {
+    tracks[n++] = rocket->tracks[i];
+  }
+  return rocket->groups[g].numtracks;
+}
+
+static mrocket_track_t *_minirocket_new_track(mrocket_t *rocket, const char *name, size_t len) {
+  if(rocket->numtracks == rocket->maxtracks) {
+    unsigned int maxtracks = rocket->maxtracks ? rocket->maxtracks * 2 : MR_MIN_TRACKS;
+    mrocket_track_t **tracks = realloc(rocket->tracks, maxtracks * sizeof(mrocket_track_t *));
+    if(tracks == NULL) {
+      fprintf(stderr, "minirocket: out of memory growing track table to %u\n", maxtracks);
+      return NULL;
+    }
+    rocket->tracks = tracks;
+    rocket->maxtracks = maxtracks;
+  }
+
+  mrocket_track_t *track = malloc(sizeof(mrocket_track_t));
+  if(track == NULL) {
+    return NULL;
+  }
+  memset(track, 0, sizeof(mrocket_track_t));
+  track->name = malloc(len + 1);
+  if(track->name == NULL) {
+    free(track);
+    return NULL;
+  }
+  memcpy(track->name, name, len);
+  track->name[len] = 0;
+  track->cursor = -1;
+  track->id = rocket->numtracks;
+  track->rocket = rocket;
+  rocket->tracks[rocket->numtracks++] = track;
+  _minirocket_register_track(rocket, track);
+  return track;
+}
+
+static void *_minirocket_map_file(const char *filename, size_t *size)
+{
+  static char empty[1];
+  struct stat st;
+#if defined(_WIN32)
+  FILE *fd = fopen(filename, "rb");
+  if(fd == NULL || fstat(fileno(fd), &st) != 0) {
+    perror(filename);
+    if(fd != NULL) {
+      fclose(fd);
+    }
+    return NULL;
+  }
+  void *map = malloc(st.st_size);
+  if(map == NULL || fread(map, 1, st.st_size, fd) != (size_t)st.st_size) {
+    perror(filename);
+    free(map);
+    fclose(fd);
+    return NULL;
+  }
+  fclose(fd);
+  (void)empty;
+#else
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) != 0) {
+    perror(filename);
+    if(fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  if(st.st_size == 0) {
+    close(fd);
+    *size = 0;
+    return empty;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    perror(filename);
+    return NULL;
+  }
+#endif
+  *size = st.st_size;
+  return map;
+}
+
+static void _minirocket_unmap_file(void *map, size_t size)
+{
+  if(size == 0) {
+    return;
+  }
+#if defined(_WIN32)
+  free(map);
+#else
+  munmap(map, size);
+#endif
+}
+
+static bool _minirocket_is_mapped(mrocket_t *rocket, const void *p) {
+  return rocket->map != NULL &&
+    (const char *)p >= (const char *)rocket->map &&
+    (const char *)p < (const char *)rocket->map + rocket->mapsize;
+}
+
+/**
+ * Paged timelines (see minirocket_read_paged) keep only some windows of
+ * pager->rows rows in memory. For every track, a window holds the keys from
+ * the last one at or before its first row to the first one at or after its
+ * end, so any row inside it evaluates as it would with the whole track.
+ */
+typedef struct __mrocket_window_t {
+  struct __mrocket_window_t *next;
+  unsigned int	 index;   // covers rows [index * rows, (index + 1) * rows)
+  size_t	 bytes;
+  unsigned int	 *start;  // first key of each track in keys, numtracks + 1 entries
+  mrocket_key_t	 keys[];
+} mrocket_window_t;
+
+#define MR_NO_WINDOW 0xffffffffu
+
+#if !defined(MR_NO_THREADS) && !defined(_WIN32)
+#define MR_PREFETCH  // load the next window on a background thread
+#endif
+
+typedef struct __mrocket_pager_t {
+#if defined(_WIN32)
+  FILE		 *file;
+#else
+  int		 fd;
+#endif
+  unsigned int	 rows;      // per window
+  size_t	 budget;    // bytes of windows to keep, see _minirocket_pager_evict
+  size_t	 bytes;     // of the loaded windows
+  unsigned int	 numtracks;
+  uint64_t	 *offsets;  // file offset of each track's keys
+  unsigned int	 *numkeys;
+  mrocket_window_t *windows;  // loaded, in no particular order
+  mrocket_window_t *current;  // the one the tracks point into, NULL if failed
+  unsigned int	 index;     // window the tracks are at
+  unsigned int	 rowlo;     // its first and last row
+  unsigned int	 rowhi;
+  bool		 failed;    // it could not be read and the tracks are empty
+  bool		 reported;  // the failure was printed, see _minirocket_page_retry
+  unsigned int	 retry_wait;  // ticks between retries, doubling up to MR_PAGE_RETRY_MAX
+  unsigned int	 retry_in;
+#ifdef MR_PREFETCH
+  pthread_t	 thread;
+  pthread_mutex_t lock;     // guards windows, bytes, current, index and want
+  pthread_cond_t cond;
+  unsigned int	 want;      // window to prefetch, MR_NO_WINDOW if none
+  bool		 running;
+  bool		 quit;
+#endif
+} mrocket_pager_t;
+
+static void _minirocket_free_window(mrocket_window_t *window)
+{
+  free(window->start);
+  free(window);
+}
+
+static void _minirocket_pager_free(mrocket_pager_t *pager)
+{
+#ifdef MR_PREFETCH
+  if(pager->running) {
+    pthread_mutex_lock(&pager->lock);
+    pager->quit = true;
+    pthread_cond_signal(&pager->cond);
+    pthread_mutex_unlock(&pager->lock);
+    pthread_join(pager->thread, NULL);
+  }
+  pthread_cond_destroy(&pager->cond);
+  pthread_mutex_destroy(&pager->lock);
+#endif
+  while(pager->windows != NULL) {
+    mrocket_window_t *next = pager->windows->next;
+    _minirocket_free_window(pager->windows);
+    pager->windows = next;
+  }
+#if defined(_WIN32)
+  if(pager->file != NULL) {
+    fclose(pager->file);
+  }
+#else
+  if(pager->fd >= 0) {
+    close(pager->fd);
+  }
+#endif
+  free(pager->offsets);
+  free(pager->numkeys);
+  free(pager);
+}
+
+static void _minirocket_destroy(mrocket_t *rocket)
+{
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    if(track->maxkeys != 0) {
+      free(track->keys);
+    }
+    if(track->packed != NULL) {
+      free(track->packed->cache);
+      free(track->packed);
+    }
+    free(track->segs);
+    free(track->baked);
+    if(!_minirocket_is_mapped(rocket, track->name)) {
+      free(track->name);
+    }
+    if(track < rocket->trackpool || track >= rocket->trackpool + rocket->poolsize) {
+      free(track);
+    }
+  }
+  free(rocket->trackpool);
+  free(rocket->tracks);
+  free(rocket->trackhash);
+  free(rocket->grouphash);
+  free(rocket->groups);
+  free(rocket->values);
+  free(rocket->changed);
+#ifndef MR_NO_THREADS
+  if(rocket->rcu != NULL) {
+    _minirocket_rcu_free(rocket->rcu);
+  }
+  if(rocket->pool != NULL) {
+    _minirocket_pool_free(rocket->pool);
+  }
+#endif
+  if(rocket->map != NULL) {
+    _minirocket_unmap_file(rocket->map, rocket->mapsize);
+  }
+  if(rocket->pager != NULL) {
+    _minirocket_pager_free(rocket->pager);
+  }
+#ifndef MR_NO_NETWORK
+#ifndef MR_NO_THREADS
+  if(rocket->saver != NULL) {
+    _minirocket_saver_stop(rocket->saver);
+  }
+#endif
+  free(rocket->save_path);
+#endif
+  free(rocket);
+}
+
+// Frees the rocket once the owner and every playhead have let go of it
+static void _minirocket_release(mrocket_t *rocket)
+{
+#ifndef MR_NO_THREADS
+  if(atomic_fetch_sub_explicit(&rocket->refs, 1, memory_order_acq_rel) == 1) {
+    _minirocket_destroy(rocket);
+  }
+#else
+  if(--rocket->refs == 0) {
+    _minirocket_destroy(rocket);
+  }
+#endif
+}
+
+void minirocket_free(mrocket_t *rocket)
+{
+  _minirocket_release(rocket);
+}
+
+static const double _minirocket_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Length of word (lower case) if p starts with it in any case, else 0
+static size_t _minirocket_match_word(const char *p, const char *end, const char *word)
+{
+  size_t n = strlen(word);
+  if((size_t)(end - p) < n) {
+    return 0;
+  }
+  for(size_t i=0; i < n; i++) {
+    if((p[i] | 0x20) != word[i]) {
+      return 0;
+    }
+  }
+  return n;
+}
+
+/**
+ * Locale-independent decimal float parser for the [-]ddd[.ddd][e[+-]dd]
+ * values written by minirocket_dump_to_file(), and the [-]nan and [-]inf
+ * printf writes for non-finite ones. Returns the end of the number, or
+ * NULL if p does not start with one.
+ */
+static const char *_minirocket_parse_float(const char *p, const char *end, float *out)
+{
+  bool negative = false;
+  if(p < end && (*p == '-' || *p == '+')) {
+    negative = *p++ == '-';
+  }
+
+  size_t n;
+  if((n = _minirocket_match_word(p, end, "inf")) > 0) {
+    p += n;
+    p += _minirocket_match_word(p, end, "inity");
+    *out = negative ? -INFINITY : INFINITY;
+    return p;
+  }
+  if((n = _minirocket_match_word(p, end, "nan")) > 0) {
+    p += n;
+    if(p < end && *p == '(') {
+      // nan(payload), e.g. nan(ind) from MSVC
+      const char *q = p + 1;
+      while(q < end && *q != ')' && *q != '\n') {
+	q++;
+      }
+      p = q < end && *q == ')' ? q + 1 : p;
+    }
+    *out = negative ? -NAN : NAN;
+    return p;
+  }
+
+  uint64_t mantissa = 0;
+  int exponent = 0, digits = 0;
+  for(; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+    if(mantissa < 100000000000000000ULL) {
+      mantissa = mantissa * 10 + (*p - '0');
+    } else {
+      exponent++;
+    }
+  }
+  if(p < end && *p == '.') {
+    for(p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+      if(mantissa < 100000000000000000ULL) {
+	mantissa = mantissa * 10 + (*p - '0');
+	exponent--;
+      }
+    }
+  }
+  if(digits == 0) {
+    return NULL;
+  }
+  if(p < end && (*p == 'e' || *p == 'E')) {
+    bool negexp = false;
+    const char *q = p + 1;
+    if(q < end && (*q == '-' || *q == '+')) {
+      negexp = *q++ == '-';
+    }
+    if(q < end && *q >= '0' && *q <= '9') {
+      int e = 0;
+      for(; q < end && *q >= '0' && *q <= '9'; q++) {
+	if(e < 10000) {
+	  e = e * 10 + (*q - '0');
+	}
+      }
+      exponent += negexp ? -e : e;
+      p = q;
+    }
+  }
+
+  double value = (double)mantissa;
+  if(exponent < 0) {
+    value = exponent >= -22 ? value / _minirocket_pow10[-exponent] : value * pow(10.0, exponent);
+  } else if(exponent > 0) {
+    value = exponent <= 22 ? value * _minirocket_pow10[exponent] : value * pow(10.0, exponent);
+  }
+  *out = (float)(negative ? -value : value);
+  return p;
+}
+
+static const char *_minirocket_skip_blanks(const char *p, const char *end)
+{
+  while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    p++;
+  }
+  return p;
+}
+
+/**
+ * Parses a text timeline in two passes over the buffer: the first counts
+ * the keys of every track so each key array is allocated exactly once,
+ * the second fills them in. Errors are reported as name:line.
+ */
+mrocket_t *minirocket_read_from_memory(const char *data, size_t size, const char *name)
+{
+  const char *end = data + size;
+  unsigned int numtracks = 0;
+  for(const char *p = data; p < end; p++) {
+    if(*p == '#' && (p == data || p[-1] == '\n')) {
+      numtracks++;
+    }
+  }
+
+  mrocket_t *rocket = mrocket_init();
+  unsigned int *counts = calloc(numtracks + 1, sizeof(unsigned int));
+  if(rocket == NULL || counts == NULL) {
+    fprintf(stderr, "minirocket: out of memory reading %s\n", name);
+    free(counts);
+    free(rocket);
+    return NULL;
+  }
+  if(numtracks > 0) {
+    rocket->tracks = malloc(numtracks * sizeof(mrocket_track_t *));
+    rocket->maxtracks = numtracks;
+  }
+
+  // counts[0] holds keys before the first track name, which is an error
+  unsigned int t = 0;
+  for(const char *p = data; p < end; ) {
+    const char *eol = memchr(p, '\n', end - p);
+    eol = eol ? eol : end;
+    if(*p == '#') {
+      t++;
+    } else if(_minirocket_skip_blanks(p, eol) < eol) {
+      counts[t]++;
+    }
+    p = eol + 1;
+  }
+
+  unsigned int line = 0;
+  const char *error = NULL;
+  mrocket_track_t *track = NULL;
+  t = 0;
+  for(const char *p = data; p < end && error == NULL; ) {
+    const char *eol = memchr(p, '\n', end - p);
+    eol = eol ? eol : end;
+    line++;
+
+    if(*p == '#') { // track name
+      const char *e = eol;
+      while(e > p + 1 && e[-1] == '\r') {
+	e--;
+      }
+      if(track != NULL) {
+	_minirocket_sort_keys(track);
+      }
+      track = _minirocket_new_track(rocket, p + 1, e - p - 1);
+      if(track == NULL || !_minirocket_track_reserve(track, counts[++t])) {
+	error = "out of memory";
+      }
+    }
+    else if((p = _minirocket_skip_blanks(p, eol)) < eol) {
+      if(track == NULL) {
+	error = "key before the first #track line";
+	break;
+      }
+      unsigned long row = 0;
+      const char *q = p;
+      for(; q < eol && *q >= '0' && *q <= '9' && row <= 0xffffffffUL; q++) {
+	row = row * 10 + (*q - '0');
+      }
+      float value;
+      if(q == p || row > 0xffffffffUL || (q < eol && *q != ' ' && *q != '\t')) {
+	error = "expected row number";
+      } else if((q = _minirocket_parse_float(_minirocket_skip_blanks(q, eol), eol, &value)) == NULL) {
+	error = "expected key value";
+      } else if((q = _minirocket_skip_blanks(q, eol)) == eol || *q < '0' || *q > '3') {
+	error = "expected interpolation 0-3";
+      } else if(_minirocket_skip_blanks(q + 1, eol) != eol) {
+	error = "trailing characters after key";
+      } else {
+	mrocket_key_t *key = &track->keys[track->numkeys++];
+	key->row = (unsigned int)row;
+	key->value = value;
+	key->interp = *q - '0';
+	key->p1 = key->p2 = key->p3 = 0;
+      }
+    }
+    p = eol + 1;
+  }
+  free(counts);
+
+  if(error != NULL) {
+    fprintf(stderr, "%s:%u: %s\n", name, line, error); fflush(stderr);
+    minirocket_free(rocket);
+    return NULL;
+  }
+  if(track != NULL) {
+    _minirocket_sort_keys(track);
+  }
+  return rocket;
+}
+
+mrocket_t *minirocket_read_from_file(const char *filename) 
+{
+  size_t size = 0;
+  const char *data = _minirocket_map_file(filename, &size);
+  if(data == NULL) {
+    return NULL;
+  }
+  mrocket_t *rocket = minirocket_read_from_memory(data, size, filename);
+  _minirocket_unmap_file((void *)data, size);
+  return rocket;
+}
+
+
+bool minirocket_write_to_file(mrocket_t *rocket, const char *filename) 
+{
+  if(rocket->pager != NULL) {
+    fprintf(stderr, "minirocket: paged timelines only hold one window and cannot be written\n");
+    return false;
+  }
+  FILE *fd = fopen(filename, "w");
+  if(fd == NULL) {
+    perror("fopen");
+    return false;
+  }
+  minirocket_dump_to_file(rocket, fd);
+
+  fclose(fd);
+  return true;
+}
+
+/**
+ * Binary timeline layout (host byte order, checked via byteorder):
+ *
+ *   mrocket_bin_header_t
+ *   mrocket_bin_track_t[numtracks]
+ *   NUL-terminated track names
+ *   per track, 4-byte aligned: mrocket_key_t[numkeys]
+ *
+ * Key arrays are stored exactly as mrocket_key_t so a mapped file can be
+ * evaluated in place.
+ */
+#define MR_BIN_MAGIC "MRKB"
+#define MR_BIN_VERSION 1
+#define MR_BIN_BYTEORDER 0x01020304
+
+typedef struct {
+  char		magic[4];
+  uint32_t	version;
+  uint32_t	byteorder;
+  uint32_t	numtracks;
+  uint64_t	size;
+} mrocket_bin_header_t;
+
+typedef struct {
+  uint32_t	name;     // file offset of the track name
+  uint32_t	numkeys;
+  uint64_t	keys;     // file offset of the key array
+} mrocket_bin_track_t;
+
+bool minirocket_write_binary(mrocket_t *rocket, const char *filename)
+{
+  if(rocket->pager != NULL) {
+    fprintf(stderr, "minirocket: paged timelines only hold one window and cannot be written\n");
+    return false;
+  }
+  uint64_t offset = sizeof(mrocket_bin_header_t) + rocket->numtracks * sizeof(mrocket_bin_track_t);
+  uint64_t names = offset;
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    offset += strlen(rocket->tracks[i]->name) + 1;
+  }
+  offset = (offset + 3) & ~(uint64_t)3;
+
+  FILE *fd = fopen(filename, "wb");
+  if(fd == NULL) {
+    perror("fopen");
+    return false;
+  }
+
+  mrocket_bin_header_t header = {MR_BIN_MAGIC, MR_BIN_VERSION, MR_BIN_BYTEORDER, rocket->numtracks, 0};
+  uint64_t keys = offset;
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    offset += rocket->tracks[i]->numkeys * sizeof(mrocket_key_t);
+  }
+  header.size = offset;
+  fwrite(&header, sizeof(header), 1, fd);
+
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    mrocket_bin_track_t entry = {(uint32_t)names, track->numkeys, keys};
+    names += strlen(track->name) + 1;
+    keys += track->numkeys * sizeof(mrocket_key_t);
+    fwrite(&entry, sizeof(entry), 1, fd);
+  }
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    fwrite(rocket->tracks[i]->name, strlen(rocket->tracks[i]->name) + 1, 1, fd);
+  }
+  static const char pad[4];
+  fwrite(pad, (4 - names % 4) % 4, 1, fd);
+
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    mrocket_key_t chunk[256];
+    for(unsigned int j=0; j < track->numkeys; j += 256) {
+      unsigned int n = track->numkeys - j < 256 ? track->numkeys - j : 256;
+      _minirocket_copy_keys(track, j, n, chunk);
+      for(unsigned int k=0; k < n; k++) {
+	chunk[k].p1 = chunk[k].p2 = chunk[k].p3 = 0;
+      }
+      fwrite(chunk, sizeof(mrocket_key_t), n, fd);
+    }
+  }
+
+  if(ferror(fd)) {
+    perror("minirocket_write_binary");
+    fclose(fd);
+    return false;
+  }
+  return fclose(fd) == 0;
+}
+
+mrocket_t *minirocket_read_binary(const char *filename)
+{
+  size_t size = 0;
+  char *map = _minirocket_map_file(filename, &size);
+  if(map == NULL) {
+    return NULL;
+  }
+  mrocket_t *rocket = mrocket_init();
+  rocket->map = map;
+  rocket->mapsize = size;
+
+  mrocket_bin_header_t *header = (mrocket_bin_header_t *)map;
+  if(size < sizeof(mrocket_bin_header_t) ||
+     memcmp(header->magic, MR_BIN_MAGIC, 4) != 0 ||
+     header->version != MR_BIN_VERSION ||
+     header->byteorder != MR_BIN_BYTEORDER ||
+     header->size != size ||
+     header->numtracks > (size - sizeof(mrocket_bin_header_t)) / sizeof(mrocket_bin_track_t)) {
+    fprintf(stderr, "minirocket: %s is not a valid binary timeline\n", filename);
+    minirocket_free(rocket);
+    return NULL;
+  }
+
+  unsigned int numtracks = header->numtracks;
+  mrocket_bin_track_t *entries = (mrocket_bin_track_t *)(map + sizeof(mrocket_bin_header_t));
+  rocket->tracks = malloc(numtracks * sizeof(mrocket_track_t *));
+  rocket->trackpool = calloc(numtracks, sizeof(mrocket_track_t));
+  if(numtracks > 0 && (rocket->tracks == NULL || rocket->trackpool == NULL)) {
+    fprintf(stderr, "minirocket: out of memory loading %s\n", filename);
+    minirocket_free(rocket);
+    return NULL;
+  }
+  rocket->maxtracks = rocket->poolsize = numtracks;
+
+  for(unsigned int i=0; i < numtracks; i++) {
+    mrocket_bin_track_t *entry = &entries[i];
+    if(entry->name >= size || memchr(map + entry->name, 0, size - entry->name) == NULL ||
+       entry->keys % 4 != 0 || entry->keys > size ||
+       entry->numkeys > (size - entry->keys) / sizeof(mrocket_key_t)) {
+      fprintf(stderr, "minirocket: %s: track %u is corrupt\n", filename, i);
+      minirocket_free(rocket);
+      return NULL;
+    }
+    mrocket_track_t *track = &rocket->trackpool[i];
+    track->name = map + entry->name;
+    track->id = i;
+    track->numkeys = entry->numkeys;
+    track->maxkeys = 0;
+    track->cursor = -1;
+    track->keys = (mrocket_key_t *)(map + entry->keys);
+    track->rocket = rocket;
+    rocket->tracks[rocket->numtracks++] = track;
+    _minirocket_register_track(rocket, track);
+  }
+  return rocket;
+}
+
+static bool _minirocket_pread(mrocket_pager_t *pager, void *buf, size_t size, uint64_t offset)
+{
+#if defined(_WIN32)
+  return _fseeki64(pager->file, offset, SEEK_SET) == 0 && fread(buf, 1, size, pager->file) == size;
+#else
+  char *p = buf;
+  while(size > 0) {
+    ssize_t n = pread(pager->fd, p, size, offset);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+#endif
+}
+
+static void _minirocket_pager_lock(mrocket_pager_t *pager)
+{
+#ifdef MR_PREFETCH
+  pthread_mutex_lock(&pager->lock);
+#else
+  (void)pager;
+#endif
+}
+
+static void _minirocket_pager_unlock(mrocket_pager_t *pager)
+{
+#ifdef MR_PREFETCH
+  pthread_mutex_unlock(&pager->lock);
+#else
+  (void)pager;
+#endif
+}
+
+#define MR_PAGE_SCAN 256  // keys read at once to finish a search in the file
+
+// Index of the first key of track t in the file whose row is >= row
+static bool _minirocket_pager_search(mrocket_pager_t *pager, unsigned int t, uint64_t row, unsigned int *out)
+{
+  unsigned int lo = 0, hi = pager->numkeys[t];
+  uint64_t base = pager->offsets[t];
+  while(hi - lo > MR_PAGE_SCAN) {
+    unsigned int mi = lo + (hi - lo) / 2;
+    unsigned int r;
+    if(!_minirocket_pread(pager, &r, sizeof(r), base + (uint64_t)mi * sizeof(mrocket_key_t) + offsetof(mrocket_key_t, row))) {
+      return false;
+    }
+    if(r < row) {
+      lo = mi + 1;
+    } else {
+      hi = mi;
+    }
+  }
+  mrocket_key_t keys[MR_PAGE_SCAN];
+  if(!_minirocket_pread(pager, keys, (hi - lo) * sizeof(mrocket_key_t), base + (uint64_t)lo * sizeof(mrocket_key_t))) {
+    return false;
+  }
+  unsigned int i = 0;
+  while(lo + i < hi && keys[i].row < row) {
+    i++;
+  }
+  *out = lo + i;
+  return true;
+}
+
+static mrocket_window_t *_minirocket_load_window(mrocket_pager_t *pager, unsigned int index)
+{
+  unsigned int numtracks = pager->numtracks;
+  unsigned int *start = malloc((numtracks + 1) * sizeof(unsigned int));
+  unsigned int *first = malloc((numtracks + 1) * sizeof(unsigned int));
+  if(start == NULL || first == NULL) {
+    free(start);
+    free(first);
+    return NULL;
+  }
+
+  uint64_t rowlo = (uint64_t)index * pager->rows, rowend = rowlo + pager->rows;
+  unsigned int numkeys = 0;
+  for(unsigned int t=0; t < numtracks; t++) {
+    start[t] = numkeys;
+    first[t] = 0;
+    if(pager->numkeys[t] == 0) {
+      continue;
+    }
+    unsigned int after, last;
+    if(!_minirocket_pager_search(pager, t, rowlo + 1, &after) ||
+       !_minirocket_pager_search(pager, t, rowend, &last)) {
+      free(start);
+      free(first);
+      return NULL;
+    }
+    first[t] = after > 0 ? after - 1 : 0;
+    last = last < pager->numkeys[t] ? last : pager->numkeys[t] - 1;
+    numkeys += last - first[t] + 1;
+  }
+  start[numtracks] = numkeys;
+
+  mrocket_window_t *window = malloc(sizeof(mrocket_window_t) + numkeys * sizeof(mrocket_key_t));
+  if(window == NULL) {
+    free(start);
+    free(first);
+    return NULL;
+  }
+  window->next = NULL;
+  window->index = index;
+  window->bytes = sizeof(mrocket_window_t) + numkeys * sizeof(mrocket_key_t) + (numtracks + 1) * sizeof(unsigned int);
+  window->start = start;
+  for(unsigned int t=0; t < numtracks; t++) {
+    unsigned int n = start[t+1] - start[t];
+    if(n > 0 && !_minirocket_pread(pager, window->keys + start[t], n * sizeof(mrocket_key_t),
+				   pager->offsets[t] + (uint64_t)first[t] * sizeof(mrocket_key_t))) {
+      _minirocket_free_window(window);
+      free(first);
+      return NULL;
+    }
+  }
+  free(first);
+  return window;
+}
+
+static mrocket_window_t *_minirocket_pager_find(mrocket_pager_t *pager, unsigned int index)
+{
+  for(mrocket_window_t *w = pager->windows; w != NULL; w = w->next) {
+    if(w->index == index) {
+      return w;
+    }
+  }
+  return NULL;
+}
+
+// Adds window unless another thread loaded the same one first
+static mrocket_window_t *_minirocket_pager_insert(mrocket_pager_t *pager, mrocket_window_t *window)
+{
+  mrocket_window_t *loaded = _minirocket_pager_find(pager, window->index);
+  if(loaded != NULL) {
+    _minirocket_free_window(window);
+    return loaded;
+  }
+  window->next = pager->windows;
+  pager->windows = window;
+  pager->bytes += window->bytes;
+  return window;
+}
+
+/**
+ * Frees windows until the loaded ones fit the budget, those furthest behind
+ * the current window first, then those furthest ahead. The current window
+ * and the one after it are always kept.
+ */
+static void _minirocket_pager_evict(mrocket_pager_t *pager)
+{
+  unsigned int current = pager->index;
+  while(pager->bytes > pager->budget) {
+    mrocket_window_t **victim = NULL;
+    uint64_t worst = 0;
+    for(mrocket_window_t **w = &pager->windows; *w != NULL; w = &(*w)->next) {
+      unsigned int index = (*w)->index;
+      if(index == current || index == current + 1) {
+	continue;
+      }
+      uint64_t rank = index < current ? (1ULL << 32) + (current - index) : index - current;
+      if(rank > worst) {
+	worst = rank;
+	victim = w;
+      }
+    }
+    if(victim == NULL) {
+      return;
+    }
+    mrocket_window_t *window = *victim;
+    *victim = window->next;
+    pager->bytes -= window->bytes;
+    _minirocket_free_window(window);
+  }
+}
+
+#ifdef MR_PREFETCH
+static void *_minirocket_prefetch_thread(void *arg)
+{
+  mrocket_pager_t *pager = arg;
+  pthread_mutex_lock(&pager->lock);
+  while(!pager->quit) {
+    if(pager->want == MR_NO_WINDOW) {
+      pthread_cond_wait(&pager->cond, &pager->lock);
+      continue;
+    }
+    unsigned int index = pager->want;
+    pager->want = MR_NO_WINDOW;
+    if(_minirocket_pager_find(pager, index) != NULL) {
+      continue;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    mrocket_window_t *window = _minirocket_load_window(pager, index);
+    pthread_mutex_lock(&pager->lock);
+    if(window == NULL) {
+      fprintf(stderr, "minirocket: failed to prefetch rows from %u\n", index * pager->rows);
+      continue;
+    }
+    _minirocket_pager_insert(pager, window);
+    _minirocket_pager_evict(pager);
+  }
+  pthread_mutex_unlock(&pager->lock);
+  return NULL;
+}
+#endif
+
+#define MR_PAGE_RETRY_MAX 256  // most ticks between retries of a window that failed to load
+
+/**
+ * Points every track into the window holding row, loading it if it is not
+ * resident, and asks the prefetcher for the window after it. If the window
+ * cannot be read, the tracks are left empty for its rows, and only
+ * minirocket_tick() tries it again, see _minirocket_page_retry.
+ */
+static void _minirocket_page_switch(mrocket_t *rocket, unsigned int row)
+{
+  mrocket_pager_t *pager = rocket->pager;
+  unsigned int index = row / pager->rows;
+
+  _minirocket_pager_lock(pager);
+  mrocket_window_t *window = _minirocket_pager_find(pager, index);
+  if(window == NULL) {
+    _minirocket_pager_unlock(pager);
+    window = _minirocket_load_window(pager, index);
+    _minirocket_pager_lock(pager);
+    if(window != NULL) {
+      window = _minirocket_pager_insert(pager, window);
+    }
+  }
+  if(window == NULL && !(pager->failed && pager->index == index)) {
+    pager->reported = false;
+    pager->retry_wait = 1;
+    pager->retry_in = 1;
+  }
+  pager->failed = window == NULL;
+  pager->current = window;
+  pager->index = index;
+  uint64_t rowlo = (uint64_t)index * pager->rows, rowhi = rowlo + pager->rows - 1;
+  pager->rowlo = rowlo;
+  pager->rowhi = rowhi < 0xffffffffu ? rowhi : 0xffffffffu;
+  for(unsigned int i=0; i < pager->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    track->keys = window != NULL ? window->keys + window->start[i] : NULL;
+    track->numkeys = window != NULL ? window->start[i+1] - window->start[i] : 0;
+    track->cursor = -1;
+    free(track->segs);
+    track->segs = NULL;
+    track->maxsegs = 0;
+    track->steadyfrom = 1;
+    track->steadylast = 0;
+  }
+  _minirocket_pager_evict(pager);
+#ifdef MR_PREFETCH
+  uint64_t next = (uint64_t)index + 1;
+  if(window != NULL && next * pager->rows <= 0xffffffffu && next < MR_NO_WINDOW && _minirocket_pager_find(pager, next) == NULL) {
+    pager->want = next;
+    pthread_cond_signal(&pager->cond);
+  }
+#endif
+  _minirocket_pager_unlock(pager);
+}
+
+static inline void _minirocket_page_in(mrocket_t *rocket, unsigned int row)
+{
+  mrocket_pager_t *pager = rocket->pager;
+  if(pager != NULL && (row < pager->rowlo || row > pager->rowhi)) {
+    _minirocket_page_switch(rocket, row);
+  }
+}
+
+// Reports a window that failed to load once, and retries it ever less often
+static void _minirocket_page_retry(mrocket_t *rocket)
+{
+  mrocket_pager_t *pager = rocket->pager;
+  if(!pager->reported) {
+    fprintf(stderr, "minirocket: failed to load rows %u to %u, tracks are empty there\n", pager->rowlo, pager->rowhi);
+    pager->reported = true;
+  }
+  if(--pager->retry_in > 0) {
+    return;
+  }
+  pager->retry_wait = pager->retry_wait < MR_PAGE_RETRY_MAX ? pager->retry_wait * 2 : MR_PAGE_RETRY_MAX;
+  pager->retry_in = pager->retry_wait;
+  _minirocket_page_switch(rocket, pager->rowlo);
+}
+
+/**
+ * Opens a binary timeline without loading its keys. Keys are read in
+ * windows of window_rows rows (0 for MR_PAGE_ROWS) as the playhead reaches
+ * them, and windows are freed once more than budget bytes are loaded.
+ */
+mrocket_t *minirocket_read_paged(const char *filename, unsigned int window_rows, size_t budget)
+{
+  mrocket_t *rocket = mrocket_init();
+  mrocket_pager_t *pager = calloc(1, sizeof(mrocket_pager_t));
+  if(rocket == NULL || pager == NULL) {
+    fprintf(stderr, "minirocket: out of memory opening %s\n", filename);
+    free(rocket);
+    free(pager);
+    return NULL;
+  }
+  rocket->pager = pager;
+  pager->rows = window_rows > 0 ? window_rows : MR_PAGE_ROWS;
+  pager->budget = budget;
+  pager->rowlo = 1;  // no rows until the first window is loaded
+  pager->rowhi = 0;
+#ifdef MR_PREFETCH
+  pthread_mutex_init(&pager->lock, NULL);
+  pthread_cond_init(&pager->cond, NULL);
+  pager->want = MR_NO_WINDOW;
+#endif
+
+  struct stat st;
+#if defined(_WIN32)
+  pager->file = fopen(filename, "rb");
+  if(pager->file == NULL || stat(filename, &st) != 0) {
+#else
+  pager->fd = open(filename, O_RDONLY);
+  if(pager->fd < 0 || fstat(pager->fd, &st) != 0) {
+#endif
+    perror(filename);
+    minirocket_free(rocket);
+    return NULL;
+  }
+  uint64_t size = st.st_size;
+
+  mrocket_bin_header_t header;
+  if(!_minirocket_pread(pager, &header, sizeof(header), 0) ||
+     memcmp(header.magic, MR_BIN_MAGIC, 4) != 0 ||
+     header.version != MR_BIN_VERSION ||
+     header.byteorder != MR_BIN_BYTEORDER ||
+     header.size != size ||
+     header.numtracks > (size - sizeof(mrocket_bin_header_t)) / sizeof(mrocket_bin_track_t)) {
+    fprintf(stderr, "minirocket: %s is not a valid binary timeline\n", filename);
+    minirocket_free(rocket);
+    return NULL;
+  }
+
+  unsigned int numtracks = header.numtracks;
+  mrocket_bin_track_t *entries = malloc(numtracks * sizeof(mrocket_bin_track_t));
+  pager->offsets = malloc(numtracks * sizeof(uint64_t));
+  pager->numkeys = malloc(numtracks * sizeof(unsigned int));
+  if(numtracks > 0 && (entries == NULL || pager->offsets == NULL || pager->numkeys == NULL)) {
+    fprintf(stderr, "minirocket: out of memory opening %s\n", filename);
+    free(entries);
+    minirocket_free(rocket);
+    return NULL;
+  }
+  // Names lie between the track table and the first key array
+  uint64_t names = sizeof(mrocket_bin_header_t) + (uint64_t)numtracks * sizeof(mrocket_bin_track_t);
+  uint64_t namesend = size;
+  bool valid = _minirocket_pread(pager, entries, numtracks * sizeof(mrocket_bin_track_t), sizeof(mrocket_bin_header_t));
+  for(unsigned int i=0; valid && i < numtracks; i++) {
+    mrocket_bin_track_t *entry = &entries[i];
+    valid = entry->keys % 4 == 0 && entry->keys >= names && entry->keys <= size &&
+      entry->numkeys <= (size - entry->keys) / sizeof(mrocket_key_t);
+    namesend = entry->keys < namesend ? entry->keys : namesend;
+  }
+  char *namebuf = valid ? malloc(namesend - names + 1) : NULL;
+  if(namebuf == NULL || !_minirocket_pread(pager, namebuf, namesend - names, names)) {
+    fprintf(stderr, "minirocket: %s is not a valid binary timeline\n", filename);
+    free(namebuf);
+    free(entries);
+    minirocket_free(rocket);
+    return NULL;
+  }
+  namebuf[namesend - names] = 0;
+
+  for(unsigned int i=0; i < numtracks; i++) {
+    mrocket_bin_track_t *entry = &entries[i];
+    const char *name = entry->name >= names && entry->name < namesend ? namebuf + (entry->name - names) : NULL;
+    if(name == NULL || _minirocket_new_track(rocket, name, strlen(name)) == NULL) {
+      fprintf(stderr, "minirocket: %s: track %u is corrupt\n", filename, i);
+      free(namebuf);
+      free(entries);
+      minirocket_free(rocket);
+      return NULL;
+    }
+    pager->offsets[i] = entry->keys;
+    pager->numkeys[i] = entry->numkeys;
+    pager->numtracks++;
+  }
+  free(namebuf);
+  free(entries);
+
+#ifdef MR_PREFETCH
+  pager->running = pthread_create(&pager->thread, NULL, _minirocket_prefetch_thread, pager) == 0;
+  if(!pager->running) {
+    fprintf(stderr, "minirocket: failed to start prefetch thread, loading windows on demand\n");
+  }
+#endif
+  _minirocket_page_in(rocket, 0);
+  if(pager->current == NULL) {
+    fprintf(stderr, "minirocket: failed to read the keys of %s\n", filename);
+    minirocket_free(rocket);
+    return NULL;
+  }
+  return rocket;
+}
+
+
+
+
+static void minirocket_delete_key(mrocket_t *rocket, 
+				  unsigned int track_no, 
+				  unsigned int row) {
+
+  if(track_no >= rocket->numtracks) {
+    fprintf(stderr, "minirocket: track_no %d is not valid. max %d \n", track_no, rocket->numtracks);
+    return;
+  }
+  mrocket_track_t *track = rocket->tracks[track_no];
+  if(!_minirocket_track_own(track)) {
+    return;
+  }
+  unsigned int i = _minirocket_lower_bound(track->keys, track->numkeys, row);
+  if(i < track->numkeys && track->keys[i].row == row) {
+    memmove(&track->keys[i], &track->keys[i+1], (track->numkeys - i - 1) * sizeof(mrocket_key_t));
+    track->numkeys--;
+    _minirocket_segs_edited(track, i, -1);
+    _minirocket_track_edited(track);
+    MR_STAT(rocket->stats.key_edits++);
+    return;
+  }
+  fprintf(stderr, "minirocket: FAILED delete key: %d %d  numkeys:%d~\n", track_no, row, track->numkeys); fflush(stderr);
+  assert(false);
+}
+
+static void minirocket_set_key(mrocket_t *rocket, 
+			       unsigned int track_no, 
+			       unsigned int row, 
+			       float value, 
+			       unsigned char interp) 
+{
+  if(track_no >= rocket->numtracks) {
+    fprintf(stderr, "minirocket: track_no %d is not valid. max %d \n", track_no, rocket->numtracks);
+    return;
+  }
+
+  mrocket_track_t *track = rocket->tracks[track_no];
+  if(!_minirocket_track_own(track)) {
+    return;
+  }
+
+  unsigned int i = _minirocket_lower_bound(track->keys, track->numkeys, row);
+  if(i < track->numkeys && track->keys[i].row == row) {
+    track->keys[i].value = value;
+    track->keys[i].interp = interp;
+    _minirocket_segs_edited(track, i, 0);
+    _minirocket_track_edited(track);
+    MR_STAT(rocket->stats.key_edits++);
+    return;
+  }
+
+  // new key
+  if(!_minirocket_track_reserve(track, track->numkeys + 1)) {
+    return;
+  }
+  memmove(&track->keys[i+1], &track->keys[i], (track->numkeys - i) * sizeof(mrocket_key_t));
+  mrocket_key_t *key = &track->keys[i];
+  key->row = row;
+  key->value = value;
+  key->interp = interp;
+  key->p1 = key->p2 = key->p3 = 0;
+  track->numkeys++;
+  _minirocket_segs_edited(track, i, 1);
+  _minirocket_track_edited(track);
+  MR_STAT(rocket->stats.key_edits++);
+}
+
+mrocket_track_t * minirocket_create_track(mrocket_t *rocket, const char *name) 
+{
+  mrocket_track_t *existing = minirocket_find_track(rocket, name);
+  if(existing != NULL) {
+    return existing;
+  }
+
+  mrocket_track_t *track = _minirocket_new_track(rocket, name, strlen(name));
+
+#ifndef MR_NO_NETWORK
+  // The I/O thread may send the name later, so pass the track's own copy
+  if(track != NULL && rocket->sock > 0 && !_minirocket_socket_send_get_track(rocket, track->name)) {
+    fprintf(stderr, "rocket ERROR: could not send GET_TRACK\n"); fflush(stderr);
+  }
+#endif
+  // fprintf(stderr, "rocket: created track %s\n", name); fflush(stderr);
+  return track;
+}
+
+static int _find_key_index(const mrocket_key_t *keys, unsigned int numkeys, unsigned int row)
+{
+  int lo = 0, hi = numkeys;
+  while (lo < hi) {
+    unsigned int mi = ((hi + lo) >> 1);
+
+    if (keys[mi].row < row) {
+      lo = mi + 1;
+    } else if (keys[mi].row > row) {
+      hi = mi;
+    } else {
+      return mi;
+    }
+  }
+  return lo - 1;
+}
+
+/**
+ * Playback mostly moves forward by less than a key per frame, so check the
+ * segment found last time and its successor before falling back to a full
+ * binary search (after a seek, a backwards jump or an edit). Searches are
+ * counted into stats unless it is NULL.
+ */
+static int _minirocket_find_key(const mrocket_track_t *track, int *cursor, unsigned int row, minirocket_stats_t *stats)
+{
+  const mrocket_key_t *keys = track->keys;
+  int numkeys = track->numkeys;
+  int c = *cursor;
+
+  if(c < numkeys && (c < 0 || keys[c].row <= row)) {
+    if(c + 1 >= numkeys || keys[c+1].row > row) {
+      return c;
+    }
+    if(c + 2 >= numkeys || keys[c+2].row > row) {
+      return *cursor = c + 1;
+    }
+  }
+#ifndef MR_NO_STATS
+  if(stats != NULL) {
+    stats->searches++;
+    for(int n = numkeys; n > 0; n >>= 1) {
+      stats->search_steps++;
+    }
+  }
+#else
+  (void)stats;
+#endif
+  return *cursor = _find_key_index(keys, numkeys, row);
+}
+
+/**
+ * Evaluates segment index (-1 before the first key) at rowf. The same
+ * Horner step serves every interpolation mode; before the first key t is
+ * clamped to 0, which gives the first key's value.
+ */
+static float _minirocket_eval_segment(const mrocket_seg_t *segs, int index, double rowf)
+{
+  const mrocket_seg_t *seg = &segs[index < 0 ? 0 : index];
+  float t = (float)(rowf - seg->row) * seg->inv;
+  t = t > 0.0f ? t : 0.0f;
+  return ((seg->c[3] * t + seg->c[2]) * t + seg->c[1]) * t + seg->c[0];
+}
+
+// The sample position is kept in double: tables may exceed the 2^24 samples a float counts exactly
+static float _minirocket_eval_baked(const mrocket_track_t *track, double rowf)
+{
+  double s = (rowf - track->keys[0].row) * track->rocket->bakeres;
+  if(s <= 0.0) {
+    return track->baked[0];
+  }
+  if(s >= (double)(track->bakedcount - 1)) {
+    return track->baked[2 * (track->bakedcount - 1)];
+  }
+  unsigned int i = (unsigned int)s;
+  return track->baked[2*i] + track->baked[2*i+1] * (float)(s - i);
+}
+
+// Decodes block b of a compressed track into cache
+static void _minirocket_fill_cache(const mrocket_track_t *track, unsigned int b, mrocket_unpacked_t *cache)
+{
+  const mrocket_packed_t *packed = track->packed;
+  unsigned int first = b * MR_PACK_BLOCK;
+  unsigned int n = track->numkeys - first < MR_PACK_BLOCK ? track->numkeys - first : MR_PACK_BLOCK;
+  _minirocket_unpack_block(packed, b, 0, n, cache->keys);
+  if(b + 1 < packed->numblocks) {
+    _minirocket_unpack_block(packed, b + 1, 0, 1, &cache->keys[n++]);
+  }
+  memset(cache->compiled, 0, sizeof(cache->compiled));
+  cache->block = b;
+  cache->numkeys = n;
+}
+
+/**
+ * Evaluates a compressed track, decoding the block that holds row into
+ * cache unless it is there already. Rows inside the cached block skip the
+ * search of the block index.
+ */
+static float _minirocket_eval_packed(const mrocket_track_t *track, mrocket_unpacked_t *cache, unsigned int row, double rowf)
+{
+  const mrocket_packed_t *packed = track->packed;
+  unsigned int b = cache->block;
+  if(b >= packed->numblocks || (b > 0 && packed->blocks[b].row > row) ||
+     (b + 1 < packed->numblocks && packed->blocks[b+1].row <= row)) {
+    unsigned int lo = 1, hi = packed->numblocks;
+    while(lo < hi) {
+      unsigned int mi = (lo + hi) >> 1;
+      if(packed->blocks[mi].row <= row) {
+	lo = mi + 1;
+      } else {
+	hi = mi;
+      }
+    }
+    _minirocket_fill_cache(track, lo - 1, cache);
+  }
+  int index = _find_key_index(cache->keys, cache->numkeys, row);
+  unsigned int i = index < 0 ? 0 : index;
+  if(!cache->compiled[i]) {
+    _minirocket_compile_seg(&cache->segs[i], cache->keys, cache->numkeys, i);
+    cache->compiled[i] = true;
+  }
+  return _minirocket_eval_segment(cache->segs, index, rowf);
+}
+
+static float _minirocket_eval_track(mrocket_track_t *track, double rowf, unsigned int row, minirocket_stats_t *stats)
+{
+  if(track->numkeys == 0) {
+    return 0.0f;
+  }
+  if(track->packed != NULL) {
+    return _minirocket_eval_packed(track, track->packed->cache, row, rowf);
+  }
+  if(track->baked != NULL) {
+    return _minirocket_eval_baked(track, rowf);
+  }
+  int index = _minirocket_find_key(track, &track->cursor, row, stats);
+  if(!_minirocket_track_segs(track)) {
+    return track->keys[index < 0 ? 0 : index].value;
+  }
+  return _minirocket_eval_segment(track->segs, index, rowf);
+}
+
+#ifndef MR_NO_STATS
+#define MR_STATS(rocket) (&(rocket)->stats)
+#else
+#define MR_STATS(rocket) NULL
+#endif
+
+float minirocket_get_value(mrocket_track_t *track) 
+{
+  unsigned int row;
+  double rowf = _minirocket_rowf(track->rocket, &row);
+  _minirocket_page_in(track->rocket, row);
+  MR_STAT(track->rocket->stats.get_value_calls++);
+  return _minirocket_eval_track(track, rowf, row, MR_STATS(track->rocket));
+}
+
+void minirocket_get_values(mrocket_t *rocket, mrocket_track_t **tracks, unsigned int count, float *out)
+{
+  unsigned int row;
+  double rowf = _minirocket_rowf(rocket, &row);
+  _minirocket_page_in(rocket, row);
+  MR_STAT(rocket->stats.get_value_calls += count);
+  for(unsigned int i=0; i < count; i++) {
+    out[i] = _minirocket_eval_track(tracks[i], rowf, row, MR_STATS(rocket));
+  }
+}
+
+void minirocket_get_all_values(mrocket_t *rocket, float *out)
+{
+  minirocket_get_values(rocket, rocket->tracks, rocket->numtracks, out);
+}
+
+/**
+ * Rows around row over which track keeps the value it has at row: before
+ * the first key, inside a segment with constant coefficients, or after the
+ * last key. Left empty otherwise, and for baked tracks, whose samples blend
+ * into the next segment.
+ */
+static void _minirocket_track_steady(mrocket_track_t *track, unsigned int row)
+{
+  track->steadyfrom = 1;
+  track->steadylast = 0;
+  if(track->numkeys == 0) {
+    track->steadyfrom = 0;
+    track->steadylast = 0xffffffffu;
+    return;
+  }
+  if(track->baked != NULL || !_minirocket_track_segs(track)) {
+    return;
+  }
+  int index = _minirocket_find_key(track, &track->cursor, row, NULL);
+  if(index < 0) {
+    track->steadyfrom = 0;
+    track->steadylast = track->keys[0].row - 1;
+    return;
+  }
+  const mrocket_seg_t *seg = &track->segs[index];
+  if(seg->c[1] == 0.0f && seg->c[2] == 0.0f && seg->c[3] == 0.0f) {
+    track->steadyfrom = seg->row;
+    track->steadylast = (unsigned int)index + 1 < track->numkeys ? track->keys[index+1].row - 1 : 0xffffffffu;
+  }
+}
+
+/**
+ * Re-evaluates every track that may have changed and lists those whose
+ * value differs from the last update or whose keys were edited. Tracks
+ * inside their steady rows are not evaluated at all.
+ */
+static void _minirocket_update_changes(mrocket_t *rocket)
+{
+  rocket->numchanged = 0;
+  if(rocket->numtracks > rocket->maxvalues) {
+    unsigned int maxvalues = rocket->maxtracks > rocket->numtracks ? rocket->maxtracks : rocket->numtracks;
+    float *values = realloc(rocket->values, maxvalues * sizeof(float));
+    if(values == NULL) {
+      fprintf(stderr, "minirocket: out of memory tracking changes of %u tracks\n", rocket->numtracks);
+      return;
+    }
+    rocket->values = values;
+    unsigned int *changed = realloc(rocket->changed, maxvalues * sizeof(unsigned int));
+    if(changed == NULL) {
+      fprintf(stderr, "minirocket: out of memory tracking changes of %u tracks\n", rocket->numtracks);
+      return;
+    }
+    rocket->changed = changed;
+    rocket->maxvalues = maxvalues;
+  }
+
+  unsigned int row;
+  double rowf = _minirocket_rowf(rocket, &row);
+  _minirocket_page_in(rocket, row);
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    bool known = i < rocket->numvalues;
+    if(known && !track->keysedited && row >= track->steadyfrom && row <= track->steadylast) {
+      continue;
+    }
+    float value = _minirocket_eval_track(track, rowf, row, NULL);
+    _minirocket_track_steady(track, row);
+    if(!known || track->keysedited || memcmp(&value, &rocket->values[i], sizeof(float)) != 0) {
+      rocket->values[i] = value;
+      rocket->changed[rocket->numchanged++] = i;
+    }
+    track->keysedited = false;
+  }
+  rocket->numvalues = rocket->numtracks;
+}
+
+// The next minirocket_tick() lists every track as changed
+void minirocket_enable_changes(mrocket_t *rocket)
+{
+  rocket->track_changes = true;
+  rocket->numvalues = 0;
+  rocket->numchanged = 0;
+}
+
+/**
+ * Tracks whose value changed in the last minirocket_tick(): *ids gets their
+ * ids and *values the current value of every track, by id.
+ */
+unsigned int minirocket_get_changes(mrocket_t *rocket, const unsigned int **ids, const float **values)
+{
+  *ids = rocket->changed;
+  *values = rocket->values;
+  return rocket->numchanged;
+}
+
+/**
+ * A playhead evaluates the tracks of a rocket at its own time and tempo
+ * and keeps the rocket alive until it is closed. Open it from the thread
+ * that owns the rocket, which compiles whatever segments are missing.
+ * After that, playheads only read the timeline, so any number of them can
+ * be used and closed from other threads while the timeline is not edited.
+ * With cursors, each playhead remembers its own segment per track, which
+ * makes forward play cheap; without, it does a binary search per value
+ * and has no per-track state at all.
+ */
+mrocket_playhead_t *minirocket_open_playhead(mrocket_t *rocket, bool cursors)
+{
+  if(rocket->pager != NULL) {
+    fprintf(stderr, "minirocket: paged timelines hold one window, playheads need them all\n");
+    return NULL;
+  }
+  mrocket_playhead_t *playhead = calloc(1, sizeof(mrocket_playhead_t));
+  if(playhead == NULL) {
+    fprintf(stderr, "minirocket: out of memory opening playhead\n");
+    return NULL;
+  }
+  if(cursors && rocket->numtracks > 0) {
+    playhead->cursors = malloc(rocket->numtracks * sizeof(int));
+    if(playhead->cursors == NULL) {
+      fprintf(stderr, "minirocket: out of memory opening playhead\n");
+      free(playhead);
+      return NULL;
+    }
+    for(unsigned int i=0; i < rocket->numtracks; i++) {
+      playhead->cursors[i] = -1;
+    }
+    playhead->numcursors = rocket->numtracks;
+  }
+  // Compile now, so that evaluation never writes to the shared tracks
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    _minirocket_track_segs(rocket->tracks[i]);
+  }
+#ifndef MR_NO_THREADS
+  atomic_fetch_add_explicit(&rocket->refs, 1, memory_order_relaxed);
+#else
+  rocket->refs++;
+#endif
+  playhead->rocket = rocket;
+  minirocket_playhead_set_tempo(playhead, rocket->bpm, rocket->rows_per_beat);
+  return playhead;
+}
+
+void minirocket_close_playhead(mrocket_playhead_t *playhead)
+{
+  _minirocket_release(playhead->rocket);
+  free(playhead->cursors);
+  free(playhead->blocks);
+  free(playhead);
+}
+
+void minirocket_playhead_set_tempo(mrocket_playhead_t *playhead, int bpm, int rows_per_beat)
+{
+  playhead->bpm = bpm;
+  playhead->rows_per_beat = rows_per_beat;
+  _minirocket_tempo(&playhead->tempo, bpm, rows_per_beat);
+}
+
+void minirocket_playhead_set_time_ns(mrocket_playhead_t *playhead, uint64_t ns)
+{
+  playhead->time_ns = ns;
+}
+
+void minirocket_playhead_advance(mrocket_playhead_t *playhead, uint64_t ns)
+{
+  if(!playhead->paused) {
+    playhead->time_ns += ns;
+  }
+}
+
+static double _minirocket_playhead_rowf(mrocket_playhead_t *playhead)
+{
+  const mrocket_tempo_t *tempo = _minirocket_tempo(&playhead->tempo, playhead->bpm, playhead->rows_per_beat);
+  return _minirocket_rowfp2rowf(_minirocket_ns2rowfp(tempo, playhead->time_ns), &playhead->row);
+}
+
+/**
+ * Slot of the playhead's block cache for a compressed track, emptied if it
+ * held another track or an earlier packing of this one. Tracks share slots
+ * by id, so a playhead reading more than MR_PLAYHEAD_BLOCKS compressed
+ * tracks may decode a block per value for some of them.
+ */
+static mrocket_blockcache_t *_minirocket_playhead_blocks(mrocket_playhead_t *playhead, const mrocket_track_t *track)
+{
+  if(playhead->blocks == NULL) {
+    playhead->blocks = calloc(MR_PLAYHEAD_BLOCKS, sizeof(mrocket_blockcache_t));
+    if(playhead->blocks == NULL) {
+      return NULL;
+    }
+  }
+  mrocket_blockcache_t *cache = &playhead->blocks[track->id % MR_PLAYHEAD_BLOCKS];
+  if(cache->track != track || cache->packing != track->packings) {
+    cache->track = track;
+    cache->packing = track->packings;
+    cache->unpacked.block = track->packed->numblocks;
+  }
+  return cache;
+}
+
+static float _minirocket_playhead_eval(mrocket_playhead_t *playhead, const mrocket_track_t *track, double rowf)
+{
+  if(track->numkeys == 0) {
+    return 0.0f;
+  }
+  if(track->baked != NULL) {
+    return _minirocket_eval_baked(track, rowf);
+  }
+  if(track->packed != NULL) {
+    mrocket_blockcache_t *cache = _minirocket_playhead_blocks(playhead, track);
+    if(cache == NULL) {
+      mrocket_unpacked_t unpacked;
+      unpacked.block = track->packed->numblocks;
+      return _minirocket_eval_packed(track, &unpacked, playhead->row, rowf);
+    }
+    return _minirocket_eval_packed(track, &cache->unpacked, playhead->row, rowf);
+  }
+  int cursor = -1;
+  int *c = track->id < playhead->numcursors ? &playhead->cursors[track->id] : &cursor;
+  int index = _minirocket_find_key(track, c, playhead->row, NULL);
+  if(track->segs == NULL) {
+    // Dropped by an unpack or created since the open: compile just this one
+    mrocket_seg_t seg;
+    _minirocket_compile_seg(&seg, track->keys, track->numkeys, index < 0 ? 0 : index);
+    return _minirocket_eval_segment(&seg, index < 0 ? -1 : 0, rowf);
+  }
+  return _minirocket_eval_segment(track->segs, index, rowf);
+}
+
+float minirocket_playhead_get_value(mrocket_playhead_t *playhead, const mrocket_track_t *track)
+{
+  return _minirocket_playhead_eval(playhead, track, _minirocket_playhead_rowf(playhead));
+}
+
+void minirocket_playhead_get_values(mrocket_playhead_t *playhead, mrocket_track_t **tracks, unsigned int count, float *out)
+{
+  double rowf = _minirocket_playhead_rowf(playhead);
+  for(unsigned int i=0; i < count; i++) {
+    out[i] = _minirocket_playhead_eval(playhead, tracks[i], rowf);
+  }
+}
+
+#ifndef MR_NO_THREADS
+static void _minirocket_pool_run(mrocket_pool_t *pool, unsigned int self)
+{
+  for(unsigned int k=0; k < pool->nthreads; k++) {
+    mrocket_worker_t *worker = &pool->workers[(self + k) % pool->nthreads];
+    unsigned int c;
+    while((c = atomic_fetch_add_explicit(&worker->next, 1, memory_order_relaxed)) < worker->end) {
+      for(unsigned int i=pool->bounds[c]; i < pool->bounds[c+1]; i++) {
+	pool->out[i] = _minirocket_eval_track(pool->tracks[i], pool->rowf, pool->row, NULL);
+      }
+    }
+  }
+}
+
+static void *_minirocket_pool_thread(void *arg)
+{
+  mrocket_worker_t *worker = arg;
+  mrocket_pool_t *pool = worker->pool;
+  unsigned long seen = 0;
+  for(;;) {
+    pthread_mutex_lock(&pool->lock);
+    while(pool->generation == seen && !pool->stop) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    seen = pool->generation;
+    bool stop = pool->stop;
+    pthread_mutex_unlock(&pool->lock);
+    if(stop) {
+      return NULL;
+    }
+    _minirocket_pool_run(pool, worker->index);
+    atomic_fetch_sub_explicit(&pool->busy, 1, memory_order_release);
+  }
+}
+
+static mrocket_pool_t *_minirocket_pool_create(unsigned int nthreads)
+{
+  mrocket_pool_t *pool = calloc(1, sizeof(mrocket_pool_t));
+  if(pool == NULL) {
+    return NULL;
+  }
+  pool->threads = calloc(nthreads, sizeof(pthread_t));
+  pool->workers = calloc(nthreads, sizeof(mrocket_worker_t));
+  if(pool->threads == NULL || pool->workers == NULL) {
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  atomic_init(&pool->busy, 0);
+  pool->numtracks = MR_NO_TRACK;
+  pool->requested = nthreads;
+  pool->nthreads = 1;
+  for(unsigned int i=0; i < nthreads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    atomic_init(&pool->workers[i].next, 0);
+    if(i > 0) {
+      if(pthread_create(&pool->threads[i], NULL, _minirocket_pool_thread, &pool->workers[i]) != 0) {
+	fprintf(stderr, "minirocket: could not start evaluation thread %u\n", i);
+	break;
+      }
+      pool->nthreads++;
+    }
+  }
+  return pool;
+}
+
+// A track costs a constant plus a binary search when the cursor misses
+static unsigned int _minirocket_track_weight(mrocket_track_t *track)
+{
+  unsigned int weight = 8;
+  for(unsigned int n = track->numkeys; n > 0; n >>= 1) {
+    weight++;
+  }
+  return weight;
+}
+
+static bool _minirocket_pool_layout(mrocket_pool_t *pool, mrocket_t *rocket, unsigned int shift)
+{
+  unsigned int numtracks = rocket->numtracks;
+  unsigned int maxchunks = pool->nthreads * MR_POOL_CHUNKS;
+  unsigned int *bounds = realloc(pool->bounds, (maxchunks + 1) * sizeof(unsigned int));
+  if(bounds == NULL) {
+    fprintf(stderr, "minirocket: out of memory splitting %u tracks\n", numtracks);
+    return false;
+  }
+  pool->bounds = bounds;
+
+  unsigned long long total = 0;
+  for(unsigned int i=0; i < numtracks; i++) {
+    total += _minirocket_track_weight(rocket->tracks[i]);
+  }
+
+  unsigned int numchunks = 0;
+  unsigned long long sum = 0;
+  unsigned int i = 0;
+  bounds[0] = 0;
+  while(i < numtracks && numchunks < maxchunks) {
+    unsigned long long target = total * (numchunks + 1) / maxchunks;
+    while(i < numtracks && (sum < target || (i + shift) % MR_POOL_LINE != 0)) {
+      sum += _minirocket_track_weight(rocket->tracks[i++]);
+    }
+    bounds[++numchunks] = i;
+  }
+  bounds[numchunks] = numtracks;
+  pool->numchunks = numchunks;
+  pool->numtracks = numtracks;
+  pool->shift = shift;
+  return true;
+}
+
+void minirocket_eval_all_parallel(mrocket_t *rocket, float *out, unsigned int nthreads)
+{
+  if(nthreads == 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpu > 0 ? ncpu : 1;
+#else
+    nthreads = 1;
+#endif
+  }
+  if(nthreads == 1 || rocket->numtracks < MR_POOL_LINE * 2) {
+    minirocket_get_all_values(rocket, out);
+    return;
+  }
+
+  mrocket_pool_t *pool = rocket->pool;
+  if(pool != NULL && pool->requested != nthreads) {
+    _minirocket_pool_free(pool);
+    pool = rocket->pool = NULL;
+  }
+  if(pool == NULL) {
+    pool = rocket->pool = _minirocket_pool_create(nthreads);
+    if(pool == NULL) {
+      fprintf(stderr, "minirocket: out of memory creating %u evaluation threads\n", nthreads);
+      minirocket_get_all_values(rocket, out);
+      return;
+    }
+  }
+
+  // Track index i is written to out[i], so align chunk ends to its lines
+  unsigned int shift = ((uintptr_t)out / sizeof(float)) % MR_POOL_LINE;
+  if((pool->numtracks != rocket->numtracks || pool->shift != shift) &&
+     !_minirocket_pool_layout(pool, rocket, shift)) {
+    minirocket_get_all_values(rocket, out);
+    return;
+  }
+
+  pool->tracks = rocket->tracks;
+  pool->out = out;
+  pool->rowf = _minirocket_rowf(rocket, &pool->row);
+  _minirocket_page_in(rocket, pool->row);
+  unsigned int run = (pool->numchunks + pool->nthreads - 1) / pool->nthreads;
+  for(unsigned int i=0; i < pool->nthreads; i++) {
+    unsigned int begin = i * run < pool->numchunks ? i * run : pool->numchunks;
+    atomic_store_explicit(&pool->workers[i].next, begin, memory_order_relaxed);
+    pool->workers[i].end = begin + run < pool->numchunks ? begin + run : pool->numchunks;
+  }
+  atomic_store_explicit(&pool->busy, pool->nthreads - 1, memory_order_relaxed);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->generation++;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  _minirocket_pool_run(pool, 0);
+  while(atomic_load_explicit(&pool->busy, memory_order_acquire) != 0) {
+    sched_yield();
+  }
+}
+#endif
+
+/**
+ * Evaluates the polynomial of seg for t = t0, t0 + dt, ... into out, with
+ * AVX or SSE when available. Every interpolation mode is the same Horner
+ * step, so the loops do not depend on the mode.
+ */
+static void _minirocket_eval_run(const mrocket_seg_t *seg, float t0, float dt, unsigned int n, float *out)
+{
+  unsigned int i = 0;
+  const float c0 = seg->c[0], c1 = seg->c[1], c2 = seg->c[2], c3 = seg->c[3];
+
+  if(c1 == 0.0f && c2 == 0.0f && c3 == 0.0f) {
+    for(; i < n; i++) {
+      out[i] = c0;
+    }
+    return;
+  }
+
+#if defined(__AVX__)
+  // t is recomputed from the sample index rather than accumulated, which
+  // would drift over long runs
+  const __m256 v0 = _mm256_set1_ps(c0), v1 = _mm256_set1_ps(c1), v2 = _mm256_set1_ps(c2), v3 = _mm256_set1_ps(c3);
+  const __m256 vt0 = _mm256_set1_ps(t0), vdt = _mm256_set1_ps(dt);
+  const __m256 lanes = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+  for(; i + 8 <= n; i += 8) {
+    __m256 t = _mm256_add_ps(vt0, _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float)i), lanes), vdt));
+    __m256 f = _mm256_add_ps(_mm256_mul_ps(v3, t), v2);
+    f = _mm256_add_ps(_mm256_mul_ps(f, t), v1);
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(f, t), v0));
+  }
+#elif defined(__SSE2__)
+  // t is recomputed from the sample index rather than accumulated, which
+  // would drift over long runs
+  const __m128 v0 = _mm_set1_ps(c0), v1 = _mm_set1_ps(c1), v2 = _mm_set1_ps(c2), v3 = _mm_set1_ps(c3);
+  const __m128 vt0 = _mm_set1_ps(t0), vdt = _mm_set1_ps(dt);
+  const __m128 lanes = _mm_set_ps(3, 2, 1, 0);
+  for(; i + 4 <= n; i += 4) {
+    __m128 t = _mm_add_ps(vt0, _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)i), lanes), vdt));
+    __m128 f = _mm_add_ps(_mm_mul_ps(v3, t), v2);
+    f = _mm_add_ps(_mm_mul_ps(f, t), v1);
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(f, t), v0));
+  }
 #endif
 
-  mrocket_track_t *track = malloc(sizeof(mrocket_track_t));
-  track->name = strdup(name);
-  track->numkeys = 0;
-  track->id = rocket->numtracks;
-  track->rocket = rocket;
-  rocket->tracks[rocket->numtracks++] = track;
-  // fprintf(stderr, "rocket: created track %s\n", name); fflush(stderr);
-  return track;
+  for(; i < n; i++) {
+    float t = t0 + (float)i * dt;
+    out[i] = ((c3 * t + c2) * t + c1) * t + c0;
+  }
 }
 
-static int _find_key_index(mrocket_key_t *keys, unsigned int numkeys, unsigned int row)
+/**
+ * Evaluates track at n timestamps t0_ms + i * dt_ms. Walks the segments
+ * once and hands each run of timestamps inside a segment to
+ * _minirocket_eval_run, instead of searching for every sample.
+ */
+void minirocket_eval_range(mrocket_track_t *track, double t0_ms, double dt_ms, unsigned int n, float *out)
 {
-  int lo = 0, hi = numkeys;
-  while (lo < hi) {
-    unsigned int mi = ((hi + lo) >> 1);
+  mrocket_t *rocket = track->rocket;
+  mrocket_key_t *keys = track->keys;
+  unsigned int numkeys = track->numkeys;
+  const double rps = rocket->bpm / 60.0 * rocket->rows_per_beat;
+  const double r0 = t0_ms * rps / 1000.0;
+  const double dr = dt_ms * rps / 1000.0;
 
-    if (keys[mi].row < row) {
-      lo = mi + 1;
-    } else if (keys[mi].row > row) {
-      hi = mi;
-    } else {
-      return mi;
+  if(track->packed != NULL) {
+    for(unsigned int i=0; i < n; i++) {
+      double rowf = r0 + i * dr;
+      unsigned int row = rowf < 0.0 ? 0 : (unsigned int)rowf;
+      out[i] = _minirocket_eval_packed(track, track->packed->cache, row, rowf < 0.0 ? 0.0 : rowf);
     }
+    return;
+  }
+  if(rocket->pager != NULL) {
+    // Samples may span windows, which replace the track's keys
+    for(unsigned int i=0; i < n; i++) {
+      double rowf = r0 + i * dr;
+      unsigned int row = rowf < 0.0 ? 0 : (unsigned int)rowf;
+      _minirocket_page_in(rocket, row);
+      out[i] = _minirocket_eval_track(track, rowf < 0.0 ? 0.0 : rowf, row, NULL);
+    }
+    return;
+  }
+  if(numkeys == 0 || !_minirocket_track_segs(track)) {
+    memset(out, 0, n * sizeof(float));
+    return;
+  }
+  const mrocket_seg_t *segs = track->segs;
+  if(dr <= 0.0) {
+    // Not moving forward, so there is no run to exploit
+    for(unsigned int i=0; i < n; i++) {
+      double rowf = r0 + i * dr;
+      int index = rowf < 0.0 ? -1 : _find_key_index(keys, numkeys, (unsigned int)floor(rowf));
+      out[i] = _minirocket_eval_segment(segs, index, rowf);
+    }
+    return;
+  }
+
+  int index = r0 < 0.0 ? -1 : _find_key_index(keys, numkeys, (unsigned int)floor(r0));
+  unsigned int i = 0;
+  while(i < n) {
+    if(index + 1 >= (int)numkeys) {
+      _minirocket_eval_run(&segs[numkeys-1], 0.0f, 0.0f, n - i, out + i);
+      return;
+    }
+
+    // samples [i, end) have rowf < next key row
+    double next = keys[index+1].row;
+    double e = ceil((next - r0) / dr);
+    unsigned int end = e <= (double)i ? i : (e >= (double)n ? n : (unsigned int)e);
+    while(end > i && r0 + (end - 1) * dr >= next) {
+      end--;
+    }
+    while(end < n && r0 + end * dr < next) {
+      end++;
+    }
+
+    if(end > i) {
+      if(index < 0) {
+	_minirocket_eval_run(&segs[0], 0.0f, 0.0f, end - i, out + i);
+      } else {
+	double k0 = keys[index].row;
+	double inv = 1.0 / (next - k0);
+	_minirocket_eval_run(&segs[index], (float)((r0 + i * dr - k0) * inv), (float)(dr * inv), end - i, out + i);
+      }
+      i = end;
+    }
+    index++;
   }
-  return lo - 1;
 }
 
-float minirocket_get_value(mrocket_track_t *track) 
+/**
+ * Samples the track bakeres times per row between its first and last key.
+ * Each sample stores its value and the delta to the end of its cell, taken
+ * from the segment the cell starts in, so playback is one lerp and step
+ * keys stay exact. Returns the largest error against exact evaluation
+ * seen at four points inside each cell, or a negative value on failure.
+ */
+static float _minirocket_bake_track(mrocket_track_t *track, unsigned int samples_per_row)
 {
-  float rowf = minirocket_time2rowf(track->rocket, track->rocket->time);
-  unsigned int row = (unsigned int)floor(rowf);
-  int index = _find_key_index(track->keys, track->numkeys, row);
+  free(track->baked);
+  track->baked = NULL;
+  track->steadyfrom = 1;
+  track->steadylast = 0;
+  if(track->numkeys < 2 || track->packed != NULL) {
+    return 0.0f;
+  }
 
-  if(index < 0) {
-    return track->keys[0].value;
+  mrocket_key_t *keys = track->keys;
+  unsigned int first = keys[0].row;
+  unsigned long long count = (unsigned long long)(keys[track->numkeys-1].row - first) * samples_per_row + 1;
+  if(count > 0x7fffffffULL) {
+    fprintf(stderr, "minirocket: track %s too long to bake\n", track->name);
+    return -1.0f;
+  }
+  if(!_minirocket_track_segs(track)) {
+    return -1.0f;
   }
+  float *baked = malloc(count * 2 * sizeof(float));
+  if(baked == NULL) {
+    fprintf(stderr, "minirocket: out of memory baking track %s\n", track->name);
+    return -1.0f;
+  }
+
+  float max_error = 0.0f;
+  int index = 0;
+  for(unsigned int i=0; i + 1 < count; i++) {
+    double r0 = (double)first + (double)i / samples_per_row;
+    double r1 = (double)first + (double)(i + 1) / samples_per_row;
+    while(index + 1 < (int)track->numkeys && keys[index+1].row <= r0) {
+      index++;
+    }
+    float v0 = _minirocket_eval_segment(track->segs, index, r0);
+    float delta = _minirocket_eval_segment(track->segs, index, r1) - v0;
+    baked[2*i] = v0;
+    baked[2*i+1] = delta;
 
-  if((unsigned int)index > track->numkeys - 2) {
-    return track->keys[track->numkeys-1].value;
+    for(int j=0; j < 4; j++) {
+      float f = (2 * j + 1) / 8.0f;
+      float exact = _minirocket_eval_segment(track->segs, index, r0 + (r1 - r0) * f);
+      float error = fabsf(v0 + delta * f - exact);
+      max_error = error > max_error ? error : max_error;
+    }
   }
-  
-  unsigned int k0 = track->keys[index].row;
-  unsigned int k1 = track->keys[index+1].row;
-  float t = (rowf - (float)k0) / ((float)k1 - (float)k0);
-  float a = track->keys[index].value;
-  float b = track->keys[index+1].value;
-  //  fprintf(stderr, "index:%d: %f -> %f  %f  (%d)\n", index, a, b, t, track->keys[index].interp);  
-  switch(track->keys[index].interp) {
-  case 0:
-    return a;
-  case 1:
-    return a + (b - a) * t;
-  case 2:
-    return a + (b - a) * t * t * (3 - 2 * t);
-  case 3:
-    return a + (b - a) * pow(t, 2.0);
-  default:
-    fprintf(stderr, "minirocket_get_value for %s: index: %d  nkeys: %d   interp: %d\n", track->name, index, track->numkeys, track->keys[index].interp);
-    assert(false);
+  baked[2*(count-1)] = keys[track->numkeys-1].value;
+  baked[2*(count-1)+1] = 0.0f;
+
+  track->baked = baked;
+  track->bakedcount = count;
+  return max_error;
+}
+
+float minirocket_bake(mrocket_t *rocket, unsigned int samples_per_row)
+{
+  float max_error = 0.0f;
+  if(samples_per_row == 0) {
+    return -1.0f;
+  }
+  if(rocket->pager != NULL) {
+    fprintf(stderr, "minirocket: paged timelines cannot be baked\n");
+    return -1.0f;
   }
+  rocket->bakeres = samples_per_row;
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    float error = _minirocket_bake_track(rocket->tracks[i], samples_per_row);
+    if(error < 0.0f) {
+      minirocket_unbake(rocket);
+      return -1.0f;
+    }
+    max_error = error > max_error ? error : max_error;
+  }
+  return max_error;
 }
 
-bool minirocket_tick(mrocket_t *rocket) {
-  bool new_row = false;
+void minirocket_unbake(mrocket_t *rocket)
+{
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    free(rocket->tracks[i]->baked);
+    rocket->tracks[i]->baked = NULL;
+    rocket->tracks[i]->steadyfrom = 1;
+    rocket->tracks[i]->steadylast = 0;
+  }
+}
 
-  if(!rocket->paused) {
+/**
+ * Packs the keys of track into blocks, see mrocket_block_t. Returns the
+ * largest value error introduced by quantizing, or a negative value if the
+ * track was left as it is.
+ */
+static float _minirocket_pack_track(mrocket_track_t *track, bool quantize)
+{
+  unsigned int numkeys = track->numkeys;
+  unsigned int numblocks = (numkeys + MR_PACK_BLOCK - 1) / MR_PACK_BLOCK;
+  for(unsigned int i=0; i < numkeys; i++) {
+    if(track->keys[i].interp > 3) {
+      return -1.0f;
+    }
+  }
+  // 5 bytes of varint and 4 of value at most per key
+  unsigned char *data = malloc((size_t)numkeys * 9);
+  mrocket_block_t *blocks = malloc(numblocks * sizeof(mrocket_block_t));
+  mrocket_unpacked_t *cache = malloc(sizeof(mrocket_unpacked_t));
+  if(data == NULL || blocks == NULL || cache == NULL) {
+    fprintf(stderr, "minirocket: out of memory compressing track %s\n", track->name);
+    free(data);
+    free(blocks);
+    free(cache);
+    return -1.0f;
+  }
 
-    unsigned int nrow = minirocket_time2row(rocket, rocket->time);
-    if(nrow != rocket->row) {
-      // fprintf(stderr, "minirocket_tick: row: %d   new row: %d\n", rocket->row, nrow); fflush(stderr);
-      rocket->row = nrow;
-      new_row = true;
-#ifndef MR_NO_NETWORK
-      minirocket_socket_send_set_row(rocket, rocket->row);
-#endif
+  float max_error = 0.0f;
+  unsigned char *p = data;
+  for(unsigned int b=0; b < numblocks; b++) {
+    const mrocket_key_t *keys = &track->keys[b * MR_PACK_BLOCK];
+    unsigned int n = numkeys - b * MR_PACK_BLOCK < MR_PACK_BLOCK ? numkeys - b * MR_PACK_BLOCK : MR_PACK_BLOCK;
+    mrocket_block_t *block = &blocks[b];
+    float lo = keys[0].value, hi = keys[0].value;
+    bool finite = true;
+    for(unsigned int i=0; i < n; i++) {
+      finite = finite && isfinite(keys[i].value);
+      lo = keys[i].value < lo ? keys[i].value : lo;
+      hi = keys[i].value > hi ? keys[i].value : hi;
+    }
+    block->row = keys[0].row;
+    block->offset = p - data;
+    block->quantized = quantize && finite;
+    block->base = lo;
+    block->scale = (hi - lo) / 65535.0f;
+
+    unsigned int row = block->row;
+    for(unsigned int i=0; i < n; i++) {
+      uint64_t v = ((uint64_t)(keys[i].row - row) << 2) | keys[i].interp;
+      row = keys[i].row;
+      while(v >= 0x80) {
+	*p++ = (v & 0x7f) | 0x80;
+	v >>= 7;
+      }
+      *p++ = (unsigned char)v;
+      if(block->quantized) {
+	unsigned int q = block->scale > 0.0f ? (unsigned int)lrintf((keys[i].value - lo) / block->scale) : 0;
+	q = q > 0xffff ? 0xffff : q;
+	float error = fabsf(block->base + (float)q * block->scale - keys[i].value);
+	max_error = error > max_error ? error : max_error;
+	*p++ = q & 0xff;
+	*p++ = q >> 8;
+      } else {
+	memcpy(p, &keys[i].value, sizeof(float));
+	p += sizeof(float);
+      }
     }
-  } else {
-    rocket->time = minirocket_row2time(rocket, rocket->row);
   }
 
-  if(rocket->sock <= 0) {
-    return new_row;
+  size_t size = sizeof(mrocket_packed_t) + numblocks * sizeof(mrocket_block_t) + (p - data);
+  mrocket_packed_t *packed = malloc(size);
+  if(packed == NULL) {
+    fprintf(stderr, "minirocket: out of memory compressing track %s\n", track->name);
+    free(data);
+    free(blocks);
+    free(cache);
+    return -1.0f;
   }
+  packed->numblocks = numblocks;
+  packed->size = size;
+  packed->cache = cache;
+  packed->data = (unsigned char *)(packed->blocks + numblocks);
+  memcpy(packed->blocks, blocks, numblocks * sizeof(mrocket_block_t));
+  memcpy(packed->data, data, p - data);
+  cache->block = numblocks;
+  free(data);
+  free(blocks);
 
+  if(track->maxkeys != 0) {
+    free(track->keys);
+  }
+  track->keys = NULL;
+  track->maxkeys = 0;
+  track->packed = packed;
+  track->packings++;
+  free(track->segs);
+  track->segs = NULL;
+  track->maxsegs = 0;
+  _minirocket_track_edited(track);
+  return max_error;
+}
 
-#ifndef MR_NO_NETWORK
-  int r = _minirocket_socket_ringbuf_read(rocket, 32);  // largest single packet is 13 bytes
-  if(r == -1) {
-    return new_row;
-  }
-  ringbuf_t *buf = rocket->buf;
-  /* if(r != 0) { */
-  /*   fprintf(stderr, "ringbuf read %d bytes\n", r); */
-  /* } */
-  if(rocket->handshake > 0) {
-    int skip = r > rocket->handshake ? rocket->handshake : r;
-    if(skip > 0) {
-      rocket->handshake -= skip; // must become 0 once
-      //fprintf(stderr, "Handshake %d\n", rocket->handshake); fflush(stderr);
-      //ringbuf_print(buf);
-      ringbuf_skip(buf, skip);
+/**
+ * Compresses every track with at least min_keys keys, see mrocket_block_t.
+ * With quantize, values are stored as 16-bit steps between the smallest and
+ * largest value of each block. Returns the largest value error that
+ * introduced (0 without quantize). Editing a track expands it again.
+ */
+float minirocket_compress(mrocket_t *rocket, unsigned int min_keys, bool quantize)
+{
+  float max_error = 0.0f;
+  if(rocket->pager != NULL) {
+    fprintf(stderr, "minirocket: paged timelines cannot be compressed\n");
+    return -1.0f;
+  }
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    mrocket_track_t *track = rocket->tracks[i];
+    if(track->packed != NULL || track->numkeys == 0 || track->numkeys < min_keys) {
+      continue;
+    }
+    float error = _minirocket_pack_track(track, quantize);
+    max_error = error > max_error ? error : max_error;
+  }
+  return max_error;
+}
+
+void minirocket_uncompress(mrocket_t *rocket)
+{
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    if(rocket->tracks[i]->packed != NULL) {
+      _minirocket_track_unpack(rocket->tracks[i]);
+    }
+  }
+}
+
+#ifndef MR_NO_THREADS
+static mrocket_keyset_t *_minirocket_keyset_copy(mrocket_track_t *track, bool *ok)
+{
+  *ok = true;
+  if(track->numkeys == 0) {
+    return NULL;
+  }
+  mrocket_keyset_t *keyset = malloc(sizeof(mrocket_keyset_t) + track->numkeys * (sizeof(mrocket_key_t) + sizeof(mrocket_seg_t)));
+  if(keyset == NULL) {
+    fprintf(stderr, "minirocket: out of memory publishing track %s\n", track->name);
+    *ok = false;
+    return NULL;
+  }
+  keyset->numkeys = track->numkeys;
+  keyset->segs = (mrocket_seg_t *)(keyset->keys + track->numkeys);
+  _minirocket_copy_keys(track, 0, track->numkeys, keyset->keys);
+  if(track->segs != NULL) {
+    memcpy(keyset->segs, track->segs, track->numkeys * sizeof(mrocket_seg_t));
+  } else {
+    for(unsigned int i=0; i < track->numkeys; i++) {
+      _minirocket_compile_seg(&keyset->segs[i], keyset->keys, track->numkeys, i);
+    }
+  }
+  return keyset;
+}
+
+static void _minirocket_rcu_retire(mrocket_rcu_t *rcu, mrocket_garbage_t *gc, unsigned long epoch)
+{
+  gc->epoch = epoch;
+  gc->next = rcu->retired;
+  rcu->retired = gc;
+}
+
+static void _minirocket_rcu_reclaim(mrocket_rcu_t *rcu)
+{
+  unsigned long oldest = ULONG_MAX;
+  for(unsigned int i=0; i < MR_MAX_READERS; i++) {
+    unsigned long epoch = atomic_load(&rcu->slots[i].epoch);
+    if(epoch != 0 && epoch < oldest) {
+      oldest = epoch;
     }
+  }
+  mrocket_garbage_t **link = &rcu->retired;
+  while(*link != NULL) {
+    mrocket_garbage_t *gc = *link;
+    if(gc->epoch < oldest) {
+      *link = gc->next;
+      free(gc);
+    } else {
+      link = &gc->next;
+    }
+  }
+}
+
+bool minirocket_publish(mrocket_t *rocket)
+{
+  mrocket_rcu_t *rcu = rocket->rcu;
+  if(rcu == NULL) {
     return false;
   }
-  else if(rocket->handshake == 0) {
-    rocket->handshake = -1;
-    //fprintf(stderr, "minirocket: Handshake done~\n"); fflush(stderr);
-    //ringbuf_print(buf);
+  _minirocket_sync_time(rocket);
+  atomic_store(&rcu->rowfp, minirocket_ns2rowfp(rocket, rocket->time_ns));
+
+  mrocket_version_t *old = atomic_load_explicit(&rcu->current, memory_order_relaxed);
+  if(rcu->numdirty == 0 && old->numtracks == rocket->numtracks) {
+    _minirocket_rcu_reclaim(rcu);
+    return true;
   }
 
-  else if(ringbuf_size(buf) > 1) {
-    unsigned char peek = ringbuf_peek(buf);
-    if(peek == CMD_PAUSE) {
-      ringbuf_skip(buf, 1);
-      rocket->paused = ringbuf_read_byte(buf) == 1;
-      //      fprintf(stderr, "Pause: %s~\n", rocket->paused?"Y":"N"); fflush(stderr);
+  mrocket_version_t *version = malloc(sizeof(mrocket_version_t) + rocket->numtracks * sizeof(mrocket_keyset_t *));
+  if(version == NULL) {
+    fprintf(stderr, "minirocket: out of memory publishing %u tracks\n", rocket->numtracks);
+    return false;
+  }
+  version->numtracks = rocket->numtracks;
+  memcpy(version->keysets, old->keysets, old->numtracks * sizeof(mrocket_keyset_t *));
+  bool ok = true;
+  for(unsigned int i=old->numtracks; ok && i < rocket->numtracks; i++) {
+    version->keysets[i] = _minirocket_keyset_copy(rocket->tracks[i], &ok);
+  }
+  for(unsigned int i=0; ok && i < rcu->numdirty; i++) {
+    unsigned int id = rcu->dirty[i];
+    // Tracks edited several times are copied once
+    if(id < old->numtracks && version->keysets[id] == old->keysets[id]) {
+      version->keysets[id] = _minirocket_keyset_copy(rocket->tracks[id], &ok);
     }
-    else if(peek == CMD_SET_ROW) { 
-      if(ringbuf_size(buf) > sizeof(long)) {
-	ringbuf_skip(buf, 1);
-	rocket->row = ringbuf_read_long(buf);
-      } else {
-	// fprintf(stderr, "peek: %02x, waiting> %d\n", peek, ringbuf_size(buf)); fflush(stderr);
+  }
+  if(!ok) {
+    // Drop the copies made so far; the edits stay recorded for the next try
+    for(unsigned int i=0; i < rocket->numtracks; i++) {
+      if(i >= old->numtracks || version->keysets[i] != old->keysets[i]) {
+	free(version->keysets[i]);
+      }
+    }
+    free(version);
+    return false;
+  }
+
+  atomic_store(&rcu->current, version);
+  unsigned long epoch = atomic_load(&rcu->epoch);
+  for(unsigned int i=0; i < old->numtracks; i++) {
+    if(old->keysets[i] != NULL && version->keysets[i] != old->keysets[i]) {
+      _minirocket_rcu_retire(rcu, &old->keysets[i]->gc, epoch);
+    }
+  }
+  _minirocket_rcu_retire(rcu, &old->gc, epoch);
+  atomic_fetch_add(&rcu->epoch, 1);
+  rcu->numdirty = 0;
+  _minirocket_rcu_reclaim(rcu);
+  return true;
+}
+
+bool minirocket_enable_snapshots(mrocket_t *rocket)
+{
+  if(rocket->rcu != NULL) {
+    return true;
+  }
+  if(rocket->pager != NULL) {
+    fprintf(stderr, "minirocket: paged timelines have no snapshots\n");
+    return false;
+  }
+  mrocket_rcu_t *rcu = calloc(1, sizeof(mrocket_rcu_t));
+  mrocket_version_t *empty = calloc(1, sizeof(mrocket_version_t));
+  if(rcu == NULL || empty == NULL) {
+    fprintf(stderr, "minirocket: out of memory enabling snapshots\n");
+    free(rcu);
+    free(empty);
+    return false;
+  }
+  atomic_init(&rcu->current, empty);
+  atomic_init(&rcu->epoch, 1);
+  for(unsigned int i=0; i < MR_MAX_READERS; i++) {
+    atomic_init(&rcu->slots[i].epoch, 0);
+    atomic_init(&rcu->slots[i].used, false);
+  }
+  rocket->rcu = rcu;
+  if(!minirocket_publish(rocket)) {
+    rocket->rcu = NULL;
+    _minirocket_rcu_free(rcu);
+    return false;
+  }
+  return true;
+}
+
+mrocket_reader_t *minirocket_open_reader(mrocket_t *rocket)
+{
+  mrocket_rcu_t *rcu = rocket->rcu;
+  if(rcu == NULL) {
+    fprintf(stderr, "minirocket: snapshots are not enabled\n");
+    return NULL;
+  }
+  for(unsigned int i=0; i < MR_MAX_READERS; i++) {
+    bool used = false;
+    if(atomic_compare_exchange_strong(&rcu->slots[i].used, &used, true)) {
+      mrocket_reader_t *reader = malloc(sizeof(mrocket_reader_t));
+      if(reader == NULL) {
+	atomic_store(&rcu->slots[i].used, false);
+	return NULL;
       }
+      reader->rcu = rcu;
+      reader->slot = &rcu->slots[i];
+      reader->version = NULL;
+      reader->rowf = 0.0;
+      reader->row = 0;
+      return reader;
     }
-    else if(peek == CMD_SET_KEY) {
-      if(ringbuf_size(buf) > sizeof(long)*3+1) {
+  }
+  fprintf(stderr, "minirocket: more than %d readers\n", MR_MAX_READERS);
+  return NULL;
+}
+
+void minirocket_close_reader(mrocket_reader_t *reader)
+{
+  minirocket_unpin(reader);
+  atomic_store(&reader->slot->used, false);
+  free(reader);
+}
+
+void minirocket_pin(mrocket_reader_t *reader)
+{
+  mrocket_rcu_t *rcu = reader->rcu;
+  atomic_store(&reader->slot->epoch, atomic_load(&rcu->epoch));
+  reader->version = atomic_load(&rcu->current);
+  reader->rowf = _minirocket_rowfp2rowf(atomic_load(&rcu->rowfp), &reader->row);
+}
+
+void minirocket_unpin(mrocket_reader_t *reader)
+{
+  reader->version = NULL;
+  atomic_store_explicit(&reader->slot->epoch, 0, memory_order_release);
+}
+
+// Snapshots are shared between threads, so no cursor and no baked table
+static float _minirocket_read_track(mrocket_reader_t *reader, const mrocket_track_t *track)
+{
+  const mrocket_version_t *version = reader->version;
+  if(track->id >= version->numtracks || version->keysets[track->id] == NULL) {
+    return 0.0f;
+  }
+  const mrocket_keyset_t *keyset = version->keysets[track->id];
+  int index = _find_key_index(keyset->keys, keyset->numkeys, reader->row);
+  return _minirocket_eval_segment(keyset->segs, index, reader->rowf);
+}
+
+float minirocket_read_value(mrocket_reader_t *reader, const mrocket_track_t *track)
+{
+  if(reader->version != NULL) {
+    return _minirocket_read_track(reader, track);
+  }
+  minirocket_pin(reader);
+  float value = _minirocket_read_track(reader, track);
+  minirocket_unpin(reader);
+  return value;
+}
+
+void minirocket_read_values(mrocket_reader_t *reader, mrocket_track_t **tracks, unsigned int count, float *out)
+{
+  bool pinned = reader->version != NULL;
+  if(!pinned) {
+    minirocket_pin(reader);
+  }
+  for(unsigned int i=0; i < count; i++) {
+    out[i] = _minirocket_read_track(reader, tracks[i]);
+  }
+  if(!pinned) {
+    minirocket_unpin(reader);
+  }
+}
+#endif
+
+#ifndef MR_NO_NETWORK
+#ifndef MR_NO_STATS
+static void _minirocket_stats_latency(mrocket_t *rocket, mrocket_cmd_t *cmd)
+{
+  long long us = _minirocket_now_us() - cmd->arrival;
+  unsigned int bucket = 0;
+  while(bucket + 1 < MR_LATENCY_BUCKETS && us >= (1LL << bucket)) {
+    bucket++;
+  }
+  rocket->stats.latency[bucket]++;
+}
+#endif
+
+static void _minirocket_apply(mrocket_t *rocket, mrocket_cmd_t *cmd)
+{
+  MR_STAT(_minirocket_stats_latency(rocket, cmd));
+  switch(cmd->cmd) {
+  case CMD_PAUSE:
+    rocket->paused = cmd->pause == 1;
+    break;
+  case CMD_SET_ROW:
+    rocket->row = cmd->row;
+    break;
+  case CMD_SET_KEY:
+    minirocket_set_key(rocket, cmd->track, cmd->row, cmd->value, cmd->interp);
+    break;
+  case CMD_DELETE_KEY:
+    minirocket_delete_key(rocket, cmd->track, cmd->row);
+    break;
+  case CMD_SAVE_TRACKS:
+    _minirocket_save(rocket);
+    break;
+  }
+}
+
+static long _minirocket_elapsed_us(struct timeval *t0)
+{
+  struct timeval t1;
+  gettimeofday(&t1, NULL);
+  return (t1.tv_sec - t0->tv_sec) * 1000000L + (t1.tv_usec - t0->tv_usec);
+}
+
+static bool _minirocket_budget_spent(mrocket_t *rocket, unsigned int commands, struct timeval *start)
+{
+  if(rocket->max_commands_per_tick > 0 && commands >= rocket->max_commands_per_tick) {
+    return true;
+  }
+  return rocket->max_tick_us > 0 && (commands & 63) == 0 &&
+    _minirocket_elapsed_us(start) >= (long)rocket->max_tick_us;
+}
+
+/**
+ * Reads until the socket would block and applies every complete command,
+ * refilling the ring buffer whenever it runs dry. Stops early once the
+ * optional per-tick command or time budget is spent; the remainder stays
+ * buffered for the next tick. With an I/O thread running, only drains the
+ * queue of commands it decoded, without any syscalls.
+ */
+static void _minirocket_socket_poll(mrocket_t *rocket)
+{
+  unsigned int commands = 0;
+  struct timeval start;
+  mrocket_cmd_t cmd = {0};
+
+  if(rocket->max_tick_us > 0) {
+    gettimeofday(&start, NULL);
+  }
 
-	//	fprintf(stderr, "rb when SET_KEY"); fflush(stderr);
-	//	ringbuf_print(buf);
+#ifndef MR_NO_THREADS
+  if(rocket->io != NULL) {
+    while(_minirocket_queue_pop(&rocket->io->in, &cmd)) {
+      _minirocket_apply(rocket, &cmd);
+      if(_minirocket_budget_spent(rocket, ++commands, &start)) {
+	return;
+      }
+    }
+    if(atomic_load(&rocket->io->closed)) {
+      _minirocket_socket_close(rocket);
+    }
+    return;
+  }
+#endif
 
-	ringbuf_skip(buf, 1);
-	unsigned long track = ringbuf_read_long(buf);
-	unsigned long row = ringbuf_read_long(buf);
-	float value = ringbuf_read_float(buf);
-	unsigned char interp = ringbuf_read_byte(buf);
+  for(;;) {
+    int r = _minirocket_socket_ringbuf_read(rocket, 0);
+    if(r == -1) {
+      _minirocket_socket_close(rocket);
+      return;
+    }
 
-	minirocket_set_key(rocket, track, row, value, interp);
+    if(_minirocket_socket_handshake(rocket)) {
+      while(_minirocket_socket_decode(rocket->buf, &cmd)) {
+	MR_STAT(_minirocket_stats_decoded(rocket, &cmd));
+	_minirocket_apply(rocket, &cmd);
+	if(_minirocket_budget_spent(rocket, ++commands, &start)) {
+	  return;
+	}
       }
-      else {
-	// fprintf(stderr, "peek: %02x, waiting for 13> %d\n", peek, ringbuf_size(buf)); fflush(stderr);
-      }    
-    }
-    else if(peek == CMD_DELETE_KEY) {
-      if(ringbuf_size(buf) > sizeof(long)*2+1) {
-	ringbuf_skip(buf, 1);
-	unsigned long track = ringbuf_read_long(buf);
-	unsigned long row = ringbuf_read_long(buf);
-	minirocket_delete_key(rocket, track, row);
+    }
+
+    if(r == 0) {
+      return;
+    }
+  }
+}
+#endif
+
+#ifndef MR_NO_STATS
+minirocket_stats_t minirocket_get_stats(mrocket_t *rocket)
+{
+  minirocket_stats_t stats = rocket->stats;
+#if !defined(MR_NO_NETWORK) && !defined(MR_NO_THREADS)
+  if(rocket->io != NULL) {
+    _minirocket_io_stats(rocket->io, &stats);
+  }
+#endif
+  return stats;
+}
+
+// Writes the statistics as one line of name=value pairs
+bool minirocket_write_stats(mrocket_t *rocket, int fd)
+{
+  minirocket_stats_t stats = minirocket_get_stats(rocket);
+  char line[1024];
+  int len = snprintf(line, sizeof(line),
+		     "minirocket rx=%llu tx=%llu syscalls=%llu set_key=%llu delete_key=%llu set_row=%llu pause=%llu save=%llu"
+		     " errors=%llu ringbuf_peak=%u ticks=%llu tick_us=%llu tick_max_us=%llu get_value=%llu"
+		     " searches=%llu search_steps=%llu key_edits=%llu latency_us=",
+		     stats.bytes_received, stats.bytes_sent, stats.syscalls,
+		     stats.commands[CMD_SET_KEY], stats.commands[CMD_DELETE_KEY], stats.commands[CMD_SET_ROW],
+		     stats.commands[CMD_PAUSE], stats.commands[CMD_SAVE_TRACKS],
+		     stats.protocol_errors, stats.ringbuf_peak, stats.ticks, stats.tick_us, stats.tick_max_us,
+		     stats.get_value_calls, stats.searches, stats.search_steps, stats.key_edits);
+  // latency buckets as <limit:count, skipping empty ones
+  for(int i=0; i < MR_LATENCY_BUCKETS && len < (int)sizeof(line) - 48; i++) {
+    if(stats.latency[i] > 0) {
+      if(i + 1 < MR_LATENCY_BUCKETS) {
+	len += snprintf(line + len, sizeof(line) - len, "<%lld:%llu,", 1LL << i, stats.latency[i]);
+      } else {
+	len += snprintf(line + len, sizeof(line) - len, ">=%lld:%llu,", 1LL << (i - 1), stats.latency[i]);
       }
     }
-    else if(peek == CMD_SAVE_TRACKS) {
-      ringbuf_skip(buf, 1);
-      fprintf(stderr, "minirocket: saving to file 'demo.rkt'!\n"); fflush(stderr);
-      minirocket_write_to_file(rocket, "demo.rkt");
-      fprintf(stderr, "minirocket: saved to file!\n"); fflush(stderr);
+  }
+  line[len++] = '\n';
+  return write(fd, line, len) == len;
+}
+
+void minirocket_set_stats_dump(mrocket_t *rocket, int fd, unsigned int interval_ms)
+{
+  rocket->stats_fd = fd;
+  rocket->stats_interval_ms = interval_ms;
+  rocket->stats_dumped_us = _minirocket_now_us();
+}
+#endif
+
+bool minirocket_tick(mrocket_t *rocket) {
+  bool new_row = false;
+  MR_STAT(long long tick_start = _minirocket_now_us());
+
+  if(!rocket->paused) {
+
+    unsigned int nrow;
+    _minirocket_rowf(rocket, &nrow);
+    if(nrow != rocket->row) {
+      // fprintf(stderr, "minirocket_tick: row: %d   new row: %d\n", rocket->row, nrow); fflush(stderr);
+      rocket->row = nrow;
+      new_row = true;
+#ifndef MR_NO_NETWORK
+      minirocket_socket_send_set_row(rocket, rocket->row);
+#endif
     }
-    else {
-      fprintf(stderr, "minirocket: protocol error: %d\n", peek); fflush(stderr);
-      ringbuf_print(buf);
-      ringbuf_skip(buf, 1);
+  } else {
+    minirocket_set_time_ns(rocket, minirocket_row2ns(rocket, rocket->row));
+  }
+
+  if(rocket->pager != NULL && rocket->pager->failed) {
+    _minirocket_page_retry(rocket);
+  }
+
+#ifndef MR_NO_NETWORK
+  if(rocket->sock > 0) {
+    _minirocket_socket_poll(rocket);
+  }
+  if(rocket->sock > 0) {
+    minirocket_flush(rocket);
+  }
+#endif
+  if(rocket->track_changes) {
+    if(rocket->paused) {
+      // the editor may have moved the row
+      minirocket_set_time_ns(rocket, minirocket_row2ns(rocket, rocket->row));
     }
+    _minirocket_update_changes(rocket);
+  }
+#ifndef MR_NO_THREADS
+  if(rocket->rcu != NULL) {
+    minirocket_publish(rocket);
+  }
+#endif
+
+#ifndef MR_NO_STATS
+  long long tick_end = _minirocket_now_us();
+  unsigned long long tick_us = tick_end - tick_start;
+  rocket->stats.ticks++;
+  rocket->stats.tick_us += tick_us;
+  rocket->stats.tick_max_us = tick_us > rocket->stats.tick_max_us ? tick_us : rocket->stats.tick_max_us;
+  if(rocket->stats_interval_ms > 0 && tick_end - rocket->stats_dumped_us >= rocket->stats_interval_ms * 1000LL) {
+    rocket->stats_dumped_us = tick_end;
+    minirocket_write_stats(rocket, rocket->stats_fd);
   }
 #endif
 
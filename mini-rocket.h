@@ -2,6 +2,8 @@
 #define __MINIROCKET_H__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #if defined(_WIN32)
 #include <winsock2.h>
 #else
@@ -11,14 +13,46 @@
 #ifndef MR_NO_NETWORK
 #include "ringbuf.h"
 #endif
+#ifndef MR_NO_THREADS
+#include <stdatomic.h>
+#endif
 
-#define MR_MAX_TRACKS 64
-#define MR_MAX_KEYS 256
+#define MR_MIN_TRACKS 16  // initial track table size, grows geometrically
+#define MR_MIN_KEYS 8     // initial key array size, grows geometrically
+#define MR_PACK_BLOCK 64  // keys per block of a compressed track
+#define MR_PLAYHEAD_BLOCKS 8  // decoded blocks of compressed tracks kept per playhead
+#define MR_RINGBUF_SIZE 4096
+#define MR_QUEUE_SIZE 4096  // commands in each I/O thread queue, power of two
+#define MR_NO_TRACK 0xffffffffu
+#define MR_MAX_READERS 64  // concurrent readers in snapshot mode
+#define MR_PAGE_ROWS 4096  // default rows per window of a paged timeline
 
 enum {CMD_SET_KEY, CMD_DELETE_KEY, CMD_GET_TRACK, CMD_SET_ROW, CMD_PAUSE, CMD_SAVE_TRACKS};
 
 typedef unsigned int trackid_t;
 
+#ifndef MR_NO_STATS
+#define MR_LATENCY_BUCKETS 20  // bucket i counts latencies below 2^i us, the last one the rest
+#define MR_ARRIVAL_MARKS 8
+
+typedef struct __minirocket_stats_t {
+  unsigned long long bytes_received;
+  unsigned long long bytes_sent;
+  unsigned long long syscalls;         // select, recv/readv and send
+  unsigned long long commands[CMD_SAVE_TRACKS+1];  // decoded, by CMD_*
+  unsigned long long protocol_errors;  // unknown command bytes skipped
+  unsigned int	     ringbuf_peak;     // most bytes buffered at once
+  unsigned long long ticks;
+  unsigned long long tick_us;          // total time spent in minirocket_tick
+  unsigned long long tick_max_us;
+  unsigned long long get_value_calls;  // values returned by minirocket_get_value(s)
+  unsigned long long searches;         // cursor misses, each a binary search
+  unsigned long long search_steps;
+  unsigned long long key_edits;
+  unsigned long long latency[MR_LATENCY_BUCKETS];  // byte arrival to command applied
+} minirocket_stats_t;
+#endif
+
 typedef struct __mrocket_key {
   unsigned int	row;
   float		value;
@@ -26,43 +60,197 @@ typedef struct __mrocket_key {
   unsigned char p1,p2,p3;
 } mrocket_key_t;
 
+// Curve from a key to the next: c0 + c1*t + c2*t^2 + c3*t^3, t = (row - key row) * inv
+typedef struct __mrocket_seg_t {
+  float		c[4];
+  float		inv;  // 1 / rows to the next key, 0 for the last key
+  unsigned int	row;
+} mrocket_seg_t;
+
 typedef struct __mrocket_track_t {
   char		*name;
   unsigned int	 id;
+  unsigned int	 hash;         // of name
+  unsigned int	 group;        // index into rocket->groups
+  unsigned int	 nextingroup;  // next track id in the same group, MR_NO_TRACK at the end
   unsigned int	 numkeys;
-  mrocket_key_t	 keys[MR_MAX_KEYS];
+  unsigned int	 maxkeys;
+  int		 cursor;  // last segment index found, -1 before the first key
+  mrocket_key_t	 *keys;   // NULL while packed
+  struct __mrocket_packed_t *packed;  // compressed keys, see minirocket_compress
+  unsigned int	 packings;  // times packed, tells playhead block caches apart
+  mrocket_seg_t	 *segs;   // one per key, NULL until first evaluated
+  unsigned int	 maxsegs;
+  float		 *baked;  // (value, delta) per sample, see minirocket_bake
+  unsigned int	 bakedcount;
+  unsigned int	 steadyfrom;  // rows over which the value is constant, empty if from > last
+  unsigned int	 steadylast;
+  bool		 keysedited;  // since the last change update, see minirocket_get_changes
   struct __mrocket_t *rocket;
 } mrocket_track_t;
 
+typedef struct __mrocket_group_t {
+  const char	*name;       // points into the name of the group's first track, not terminated
+  unsigned int	 namelen;
+  unsigned int	 hash;
+  unsigned int	 first;      // id of the first track in the group
+  unsigned int	 last;
+  unsigned int	 numtracks;
+} mrocket_group_t;
+
+// Time conversion factors for one tempo, see _minirocket_tempo
+typedef struct __mrocket_tempo_t {
+  int		bpm;          // bpm and rows_per_beat the factors are for
+  int		rows_per_beat;
+  uint64_t	rows_per_ns;  // rows per ns << 64
+  uint64_t	ns_per_row;   // ns per row << 32
+} mrocket_tempo_t;
+
 typedef struct __mrocket_t {
   bool		  paused;
   int             bpm;
   int             rows_per_beat;
-  float           time;  // matches row via time2row
+  float           time;  // ms, mirrors time_ns; writing it moves time_ns
   unsigned int	  row;   // matches time via row2time
+  uint64_t	  time_ns;     // playhead, see minirocket_set_time_ns
+  float		  time_seen;   // time as of the last sync into time_ns
+  mrocket_tempo_t tempo;      // factors for bpm and rows_per_beat
   unsigned int	  numtracks;
-  mrocket_track_t *tracks[MR_MAX_TRACKS];
+  unsigned int	  maxtracks;
+  unsigned int	  bakeres;     // samples per row of baked tracks
+  mrocket_track_t **tracks;
+  unsigned int	  *trackhash;  // name index, see _minirocket_register_track
+  unsigned int	  *grouphash;
+  unsigned int	  hashsize;
+  mrocket_group_t *groups;
+  unsigned int	  numgroups;
+  unsigned int	  maxgroups;
+  void		  *map;        // binary timeline the tracks point into
+  size_t	  mapsize;
+  mrocket_track_t *trackpool;  // tracks allocated in one block by the binary loader
+  unsigned int	  poolsize;
+  struct __mrocket_pager_t *pager;  // see minirocket_read_paged
+#ifndef MR_NO_THREADS
+  atomic_uint	  refs;           // the owner plus one per open playhead
+#else
+  unsigned int	  refs;
+#endif
+  bool		  track_changes;  // see minirocket_enable_changes
+  float		  *values;        // by track id, as of the last tick
+  unsigned int	  numvalues;      // tracks with a value in values
+  unsigned int	  maxvalues;
+  unsigned int	  *changed;       // ids of the tracks that changed in the last tick
+  unsigned int	  numchanged;
+#ifndef MR_NO_THREADS
+  struct __mrocket_rcu_t *rcu;  // see minirocket_enable_snapshots
+  struct __mrocket_pool_t *pool;  // see minirocket_eval_all_parallel
+#endif
+#ifndef MR_NO_STATS
+  minirocket_stats_t stats;     // see minirocket_get_stats
+  int		  stats_fd;
+  unsigned int	  stats_interval_ms;  // 0 = no periodic dump
+  long long	  stats_dumped_us;
+#endif
 #ifndef MR_NO_NETWORK
   int		  sock;
   int		  handshake;
   fd_set          fds;
   ringbuf_t	  *buf;
+  unsigned int	  max_commands_per_tick;  // 0 = drain everything buffered
+  unsigned int	  max_tick_us;            // 0 = no time budget
+  struct __mrocket_io_t *io;              // see minirocket_start_io_thread
+  char		  *save_path;             // CMD_SAVE_TRACKS target, NULL for demo.rkt
+  struct __mrocket_saver_t *saver;        // writes saves in the background
+  unsigned char	  *outbuf;                // outgoing commands, see minirocket_flush
+  unsigned int	  outlen;
+  unsigned int	  outmax;
+  int		  outrow;                 // offset of the pending SET_ROW in outbuf, or -1
+#ifndef MR_NO_STATS
+  long long	  arrival_us[MR_ARRIVAL_MARKS];     // time of the last reads
+  unsigned int	  arrival_end[MR_ARRIVAL_MARKS];    // buf->write after each of them
+  unsigned int	  arrivals;
+#endif
 #endif
 } mrocket_t;
 
+typedef struct __mrocket_reader_t mrocket_reader_t;
+
+// Independent position in a shared timeline, see minirocket_open_playhead
+typedef struct __mrocket_playhead_t {
+  mrocket_t	  *rocket;
+  uint64_t	  time_ns;
+  unsigned int	  row;      // row of time_ns, as of the last evaluation
+  bool		  paused;   // minirocket_playhead_advance does nothing while set
+  int		  bpm;
+  int		  rows_per_beat;
+  mrocket_tempo_t tempo;
+  int		  *cursors;    // last segment found by track id, NULL if not kept
+  unsigned int	  numcursors;
+  struct __mrocket_blockcache_t *blocks;  // MR_PLAYHEAD_BLOCKS, NULL until a compressed track is read
+} mrocket_playhead_t;
+
 
 #ifndef MR_NO_NETWORK
 mrocket_t		*minirocket_connect(const char *hostname, int port);
+mrocket_t		*minirocket_connect_fd(int sock);
 void			 minirocket_disconnect(mrocket_t *r);
 void                     minirocket_socket_send_set_row(mrocket_t *rocket, unsigned int row);
 void                     minirocket_socket_send_pause(mrocket_t *rocket, unsigned int pause);
+bool			 minirocket_flush(mrocket_t *rocket);
+bool			 minirocket_set_save_path(mrocket_t *rocket, const char *path);
+#ifndef MR_NO_THREADS
+bool			 minirocket_start_io_thread(mrocket_t *rocket);
+#endif
 #endif
 unsigned int		 minirocket_time2row(mrocket_t *r,   float time);
 float			 minirocket_row2time(mrocket_t *r,   unsigned long row);
+void			 minirocket_set_tempo(mrocket_t *r, int bpm, int rows_per_beat);
+void			 minirocket_set_time_ns(mrocket_t *r, uint64_t ns);
+uint64_t		 minirocket_ns2rowfp(mrocket_t *r, uint64_t ns);
+uint64_t		 minirocket_row2ns(mrocket_t *r, unsigned int row);
 mrocket_t *		 minirocket_read_from_file(const char *filename);
+mrocket_t *		 minirocket_read_from_memory(const char *data, size_t size, const char *name);
+void			 minirocket_free(mrocket_t *r);
 bool			 minirocket_write_to_file(mrocket_t *r, const char *filename);
+mrocket_t *		 minirocket_read_binary(const char *filename);
+bool			 minirocket_write_binary(mrocket_t *r, const char *filename);
+mrocket_t *		 minirocket_read_paged(const char *filename, unsigned int window_rows, size_t budget);
 bool			 minirocket_tick(mrocket_t *rocket);
 mrocket_track_t *	 minirocket_create_track(mrocket_t *rocket, const char *name);
+mrocket_track_t *	 minirocket_find_track(mrocket_t *rocket, const char *name);
+unsigned int		 minirocket_get_group(mrocket_t *rocket, const char *group, mrocket_track_t **tracks, unsigned int max);
 float			 minirocket_get_value(mrocket_track_t *track);
+void			 minirocket_get_values(mrocket_t *rocket, mrocket_track_t **tracks, unsigned int count, float *out);
+void			 minirocket_get_all_values(mrocket_t *rocket, float *out);
+void			 minirocket_enable_changes(mrocket_t *rocket);
+unsigned int		 minirocket_get_changes(mrocket_t *rocket, const unsigned int **ids, const float **values);
+mrocket_playhead_t *	 minirocket_open_playhead(mrocket_t *rocket, bool cursors);
+void			 minirocket_close_playhead(mrocket_playhead_t *playhead);
+void			 minirocket_playhead_set_tempo(mrocket_playhead_t *playhead, int bpm, int rows_per_beat);
+void			 minirocket_playhead_set_time_ns(mrocket_playhead_t *playhead, uint64_t ns);
+void			 minirocket_playhead_advance(mrocket_playhead_t *playhead, uint64_t ns);
+float			 minirocket_playhead_get_value(mrocket_playhead_t *playhead, const mrocket_track_t *track);
+void			 minirocket_playhead_get_values(mrocket_playhead_t *playhead, mrocket_track_t **tracks, unsigned int count, float *out);
+void			 minirocket_eval_range(mrocket_track_t *track, double t0_ms, double dt_ms, unsigned int n, float *out);
+float			 minirocket_bake(mrocket_t *rocket, unsigned int samples_per_row);
+void			 minirocket_unbake(mrocket_t *rocket);
+float			 minirocket_compress(mrocket_t *rocket, unsigned int min_keys, bool quantize);
+void			 minirocket_uncompress(mrocket_t *rocket);
 void                     minirocket_dump_to_file(mrocket_t *rocket, FILE *fd);
+#ifndef MR_NO_THREADS
+bool			 minirocket_enable_snapshots(mrocket_t *rocket);
+bool			 minirocket_publish(mrocket_t *rocket);
+mrocket_reader_t *	 minirocket_open_reader(mrocket_t *rocket);
+void			 minirocket_close_reader(mrocket_reader_t *reader);
+void			 minirocket_pin(mrocket_reader_t *reader);
+void			 minirocket_unpin(mrocket_reader_t *reader);
+float			 minirocket_read_value(mrocket_reader_t *reader, const mrocket_track_t *track);
+void			 minirocket_read_values(mrocket_reader_t *reader, mrocket_track_t **tracks, unsigned int count, float *out);
+void			 minirocket_eval_all_parallel(mrocket_t *rocket, float *out, unsigned int nthreads);
+#endif
+#ifndef MR_NO_STATS
+minirocket_stats_t	 minirocket_get_stats(mrocket_t *rocket);
+bool			 minirocket_write_stats(mrocket_t *rocket, int fd);
+void			 minirocket_set_stats_dump(mrocket_t *rocket, int fd, unsigned int interval_ms);
+#endif
 #endif
@@ -0,0 +1,520 @@
+/**
+ * Stand-in for the GNU Rocket editor, for load testing the network path.
+ * It listens on localhost, answers the handshake and then either sends a
+ * storm of random SET_KEY/DELETE_KEY commands across the tracks the
+ * client requested, or replays a recorded session.
+ *
+ *   mock-editor.exe [-p port] [-l] [-t tracks] [-r rate] [-d seconds]
+ *                   [-i probe_ms] [-w session.txt] storm
+ *   mock-editor.exe [-p port] [-l] [-t tracks] [-f] [-w session.txt] replay session.txt
+ *
+ * -r is edits per second (0 = as fast as the client reads), -w records
+ * what is sent with timestamps and -f replays without the original pauses.
+ *
+ * With -l a client running mini-rocket is started in-process (otherwise
+ * connect one, e.g. example.exe). It creates "mock:probe" and -t more
+ * tracks and ticks as fast as it can. Every -i ms the storm sets row 0 of
+ * the probe track to a sequence number, and the client reports how long
+ * each number took to show up in minirocket_get_value(), along with the
+ * sustained command rate.
+ *
+ * POSIX only.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "mini-rocket.h"
+
+#define MOCK_MAX_PROBES 65536
+#define MOCK_ROWS 10000  // storm edits rows 0 .. MOCK_ROWS-1
+
+static int port = 1338;
+static unsigned int client_tracks = 64;
+static double rate = 10000;
+static double duration = 5;
+static double probe_ms = 10;
+static bool loopback, fast;
+
+// Shared with the loopback client
+static atomic_llong probe_sent[MOCK_MAX_PROBES];  // ns, by sequence number
+static atomic_int final_probe = -1;
+static atomic_bool client_ready;
+static atomic_llong client_done;  // ns the final probe became visible
+
+static long long now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void sleep_until(long long t)
+{
+  long long d = t - now_ns();
+  if(d > 0) {
+    struct timespec ts = {d / 1000000000LL, d % 1000000000LL};
+    nanosleep(&ts, NULL);
+  }
+}
+
+typedef struct {
+  int		 sock;
+  FILE		*record;
+  long long	 start;
+  unsigned int	 numtracks;   // GET_TRACK requests seen so far
+  unsigned long	 commands;    // sent
+  unsigned char	 in[4096];    // from the client
+  size_t	 inlen;
+} editor_t;
+
+// Size of an editor command by its first byte, 0 if unknown
+static size_t command_size(unsigned char cmd)
+{
+  switch(cmd) {
+  case CMD_SET_KEY: return 14;
+  case CMD_DELETE_KEY: return 9;
+  case CMD_SET_ROW: return 5;
+  case CMD_PAUSE: return 2;
+  case CMD_SAVE_TRACKS: return 1;
+  }
+  return 0;
+}
+
+static unsigned int get_long(const unsigned char *p)
+{
+  return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static void put_long(unsigned char *p, unsigned int v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// Reads whatever the client sent and counts its track requests
+static void editor_poll(editor_t *e)
+{
+  ssize_t n;
+  while((n = recv(e->sock, e->in + e->inlen, sizeof(e->in) - e->inlen, MSG_DONTWAIT)) > 0) {
+    e->inlen += n;
+    size_t pos = 0;
+    while(pos < e->inlen) {
+      unsigned char *p = e->in + pos;
+      size_t size = 0;
+      if(p[0] == CMD_GET_TRACK) {
+	size = e->inlen - pos >= 5 ? 5 + get_long(p + 1) : 5;
+      } else if(p[0] == CMD_SET_ROW) {
+	size = 5;
+      } else if(p[0] == CMD_PAUSE) {
+	size = 2;
+      } else {
+	fprintf(stderr, "mock-editor: unknown command %d from client\n", p[0]);
+	exit(1);
+      }
+      if(size > sizeof(e->in)) {
+	fprintf(stderr, "mock-editor: track name too long\n");
+	exit(1);
+      }
+      if(pos + size > e->inlen) {
+	break;
+      }
+      if(p[0] == CMD_GET_TRACK) {
+	e->numtracks++;
+      }
+      pos += size;
+    }
+    memmove(e->in, e->in + pos, e->inlen - pos);
+    e->inlen -= pos;
+  }
+  if(n == 0) {
+    fprintf(stderr, "mock-editor: client disconnected\n");
+    exit(1);
+  }
+}
+
+/**
+ * Sends a buffer of whole commands. A SET_KEY on row 0 of track 0 is a
+ * probe whose value is its sequence number; its send time is noted for
+ * the loopback client.
+ */
+static void editor_send(editor_t *e, const unsigned char *buf, size_t len)
+{
+  long long t = now_ns();
+  for(size_t pos = 0; pos < len; pos += command_size(buf[pos])) {
+    if(buf[pos] == CMD_SET_KEY && get_long(buf + pos + 1) == 0 && get_long(buf + pos + 5) == 0) {
+      float value;
+      unsigned int bits = get_long(buf + pos + 9);
+      memcpy(&value, &bits, 4);
+      if(value >= 0 && value < MOCK_MAX_PROBES) {
+	atomic_store(&probe_sent[(int)value], t);
+      }
+    }
+    e->commands++;
+  }
+  if(e->record != NULL) {
+    fprintf(e->record, "%lld ", (t - e->start) / 1000);
+    for(size_t i=0; i < len; i++) {
+      fprintf(e->record, "%02x", buf[i]);
+    }
+    fprintf(e->record, "\n");
+  }
+  size_t sent = 0;
+  while(sent < len) {
+    ssize_t n = send(e->sock, buf + sent, len - sent, MSG_DONTWAIT);
+    if(n > 0) {
+      sent += n;
+    } else if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      perror("mock-editor: send");
+      exit(1);
+    } else {
+      editor_poll(e);  // the client may be waiting on us
+      usleep(50);
+    }
+  }
+}
+
+/**
+ * Storm generator. The rows holding a key are tracked per track so that
+ * deletes always hit an existing key.
+ */
+typedef struct {
+  unsigned int	*rows;      // MOCK_ROWS per track, the first numkeys hold keys
+  unsigned int	*numkeys;
+  unsigned char	*haskey;    // MOCK_ROWS per track
+  unsigned int	 first;     // first track to edit, 1 when track 0 is the probe
+  unsigned int	 numtracks;
+} storm_t;
+
+static size_t storm_command(storm_t *s, unsigned char *p)
+{
+  unsigned int track = s->first + rand() % (s->numtracks - s->first);
+  unsigned int *rows = s->rows + (size_t)track * MOCK_ROWS;
+  unsigned char *haskey = s->haskey + (size_t)track * MOCK_ROWS;
+  if(s->numkeys[track] > 0 && rand() % 4 == 0) {
+    unsigned int i = rand() % s->numkeys[track];
+    unsigned int row = rows[i];
+    rows[i] = rows[--s->numkeys[track]];
+    haskey[row] = 0;
+    p[0] = CMD_DELETE_KEY;
+    put_long(p + 1, track);
+    put_long(p + 5, row);
+    return 9;
+  }
+  unsigned int row = rand() % MOCK_ROWS;
+  if(!haskey[row]) {
+    haskey[row] = 1;
+    rows[s->numkeys[track]++] = row;
+  }
+  float value = (float)rand() / RAND_MAX * 100.0f;
+  unsigned int bits;
+  memcpy(&bits, &value, 4);
+  p[0] = CMD_SET_KEY;
+  put_long(p + 1, track);
+  put_long(p + 5, row);
+  put_long(p + 9, bits);
+  p[13] = rand() % 4;
+  return 14;
+}
+
+static size_t probe_command(unsigned char *p, unsigned int seq)
+{
+  float value = (float)seq;
+  unsigned int bits;
+  memcpy(&bits, &value, 4);
+  p[0] = CMD_SET_KEY;
+  put_long(p + 1, 0);
+  put_long(p + 5, 0);
+  put_long(p + 9, bits);
+  p[13] = 0;
+  return 14;
+}
+
+static void run_storm(editor_t *e)
+{
+  storm_t s = {.first = loopback ? 1 : 0, .numtracks = e->numtracks};
+  if(s.numtracks <= s.first) {
+    fprintf(stderr, "mock-editor: the client requested no tracks to edit\n");
+    exit(1);
+  }
+  s.rows = malloc((size_t)s.numtracks * MOCK_ROWS * sizeof(unsigned int));
+  s.haskey = calloc((size_t)s.numtracks * MOCK_ROWS, 1);
+  s.numkeys = calloc(s.numtracks, sizeof(unsigned int));
+
+  unsigned char buf[1024 * 14];
+  unsigned int seq = 0;
+  long long end = e->start + (long long)(duration * 1e9);
+  long long next_probe = e->start;
+  unsigned long edits = 0;
+  for(long long t = now_ns(); t < end; t = now_ns()) {
+    size_t len = 0;
+    if(loopback && t >= next_probe && seq + 1 < MOCK_MAX_PROBES) {
+      len += probe_command(buf, seq++);
+      next_probe += (long long)(probe_ms * 1e6);
+    }
+    // At a fixed rate, catch up with the schedule; at full speed, fill the buffer
+    unsigned long due = rate > 0 ? (unsigned long)((t - e->start) / 1e9 * rate) - edits : 1024;
+    while(due > 0 && len + 14 <= sizeof(buf)) {
+      len += storm_command(&s, buf + len);
+      edits++;
+      due--;
+    }
+    if(len > 0) {
+      editor_send(e, buf, len);
+    } else {
+      usleep(200);
+    }
+    editor_poll(e);
+  }
+  if(loopback) {
+    editor_send(e, buf, probe_command(buf, seq));
+    atomic_store(&final_probe, seq);
+  }
+  fprintf(stderr, "mock-editor: sent %lu edits to %u tracks in %.2f s\n",
+	  edits, s.numtracks - s.first, (now_ns() - e->start) / 1e9);
+  free(s.rows);
+  free(s.haskey);
+  free(s.numkeys);
+}
+
+static void run_replay(editor_t *e, const char *filename)
+{
+  FILE *fd = fopen(filename, "r");
+  if(fd == NULL) {
+    perror(filename);
+    exit(1);
+  }
+  char *line = NULL;
+  size_t linemax = 0;
+  unsigned char *buf = NULL;
+  size_t bufmax = 0;
+  int last_probe = -1;
+  while(getline(&line, &linemax, fd) > 0) {
+    long long t_us;
+    int hexstart;
+    if(line[0] == '#' || sscanf(line, "%lld %n", &t_us, &hexstart) != 1) {
+      continue;
+    }
+    const char *hex = line + hexstart;
+    size_t len = strspn(hex, "0123456789abcdef") / 2;
+    if(len > bufmax) {
+      bufmax = len;
+      buf = realloc(buf, bufmax);
+    }
+    for(size_t i=0; i < len; i++) {
+      unsigned int byte;
+      sscanf(hex + 2 * i, "%2x", &byte);
+      buf[i] = byte;
+    }
+    for(size_t pos = 0; pos < len; pos += command_size(buf[pos])) {
+      if(command_size(buf[pos]) == 0) {
+	fprintf(stderr, "mock-editor: %s: unknown command %d\n", filename, buf[pos]);
+	exit(1);
+      }
+      if(buf[pos] == CMD_SET_KEY && get_long(buf + pos + 1) == 0 && get_long(buf + pos + 5) == 0) {
+	float value;
+	unsigned int bits = get_long(buf + pos + 9);
+	memcpy(&value, &bits, 4);
+	last_probe = (int)value;
+      }
+    }
+    if(!fast) {
+      sleep_until(e->start + t_us * 1000);
+    }
+    editor_send(e, buf, len);
+    editor_poll(e);
+  }
+  if(loopback) {
+    // The recording may hold no probes, so end with one of our own
+    unsigned char probe[14];
+    editor_send(e, probe, probe_command(probe, last_probe + 1));
+    atomic_store(&final_probe, last_probe + 1);
+  }
+  fprintf(stderr, "mock-editor: replayed %lu commands in %.2f s\n", e->commands, (now_ns() - e->start) / 1e9);
+  free(line);
+  free(buf);
+  fclose(fd);
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * In-process client: ticks as fast as it can and times the probe values
+ * as they become visible through minirocket_get_value().
+ */
+static void *client_thread(void *arg)
+{
+  (void)arg;
+  mrocket_t *rocket = minirocket_connect("127.0.0.1", port);
+  if(rocket == NULL) {
+    exit(1);
+  }
+  rocket->bpm = 120;
+  rocket->rows_per_beat = 8;
+  mrocket_track_t *probe = minirocket_create_track(rocket, "mock:probe");
+  char name[64];
+  for(unsigned int i=0; i < client_tracks; i++) {
+    sprintf(name, "mock:track%u", i);
+    minirocket_create_track(rocket, name);
+  }
+  minirocket_flush(rocket);
+  atomic_store(&client_ready, true);
+
+  long long *latencies = malloc(MOCK_MAX_PROBES * sizeof(long long));
+  unsigned int numlatencies = 0;
+  int seen = -1;
+  unsigned long ticks = 0;
+  for(;;) {
+    minirocket_tick(rocket);
+    ticks++;
+    if(probe->numkeys > 0) {
+      int seq = (int)minirocket_get_value(probe);
+      if(seq != seen) {
+	long long t = now_ns();
+	long long sent = atomic_load(&probe_sent[seq]);
+	latencies[numlatencies++] = t - sent;
+	seen = seq;
+      }
+    }
+    int final = atomic_load(&final_probe);
+    if(final >= 0 && seen == final) {
+      atomic_store(&client_done, now_ns());
+      break;
+    }
+    if(rocket->sock <= 0) {
+      fprintf(stderr, "client: lost the editor connection\n");
+      break;
+    }
+  }
+
+  unsigned long keys = 0;
+  for(unsigned int i=0; i < rocket->numtracks; i++) {
+    keys += rocket->tracks[i]->numkeys;
+  }
+  if(numlatencies > 0) {
+    qsort(latencies, numlatencies, sizeof(long long), compare_ll);
+    double sum = 0;
+    for(unsigned int i=0; i < numlatencies; i++) {
+      sum += latencies[i];
+    }
+    fprintf(stderr, "client: %lu ticks, %lu keys in %u tracks\n", ticks, keys, rocket->numtracks);
+    fprintf(stderr, "client: edit-to-visible latency over %u probes (us): min %.1f avg %.1f p50 %.1f p99 %.1f max %.1f\n",
+	    numlatencies, latencies[0] / 1e3, sum / numlatencies / 1e3, latencies[numlatencies / 2] / 1e3,
+	    latencies[numlatencies * 99 / 100] / 1e3, latencies[numlatencies - 1] / 1e3);
+  }
+  free(latencies);
+  minirocket_disconnect(rocket);
+  return NULL;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-p port] [-l] [-t tracks] [-r rate] [-d seconds] [-i probe_ms] [-w record.txt] storm\n"
+	  "       %s [-p port] [-l] [-t tracks] [-f] [-w record.txt] replay session.txt\n", argv0, argv0);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *record = NULL;
+  int opt;
+  while((opt = getopt(argc, argv, "p:lt:r:d:i:fw:")) != -1) {
+    switch(opt) {
+    case 'p': port = atoi(optarg); break;
+    case 'l': loopback = true; break;
+    case 't': client_tracks = atoi(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 'd': duration = atof(optarg); break;
+    case 'i': probe_ms = atof(optarg); break;
+    case 'f': fast = true; break;
+    case 'w': record = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  bool replay = optind + 2 == argc && strcmp(argv[optind], "replay") == 0;
+  if(!replay && !(optind + 1 == argc && strcmp(argv[optind], "storm") == 0)) {
+    usage(argv[0]);
+  }
+
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  if(bind(server, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server, 1) != 0) {
+    perror("mock-editor: listen");
+    exit(1);
+  }
+
+  pthread_t client;
+  if(loopback) {
+    pthread_create(&client, NULL, client_thread, NULL);
+  } else {
+    fprintf(stderr, "mock-editor: waiting for a client on port %d\n", port);
+  }
+
+  editor_t e = {0};
+  e.sock = accept(server, NULL, NULL);
+  close(server);
+  setsockopt(e.sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  char hello[19];
+  if(recv(e.sock, hello, sizeof(hello), MSG_WAITALL) != sizeof(hello) || memcmp(hello, "hello, synctracker!", 19) != 0) {
+    fprintf(stderr, "mock-editor: bad greeting from client\n");
+    exit(1);
+  }
+  send(e.sock, "hello, demo!", 12, 0);
+
+  // Give the client a moment to request its tracks
+  long long deadline = now_ns() + 2000000000LL;
+  while(now_ns() < deadline && !(loopback && atomic_load(&client_ready) && e.numtracks == client_tracks + 1)) {
+    editor_poll(&e);
+    usleep(1000);
+  }
+
+  if(record != NULL) {
+    e.record = fopen(record, "w");
+    if(e.record == NULL) {
+      perror(record);
+      exit(1);
+    }
+    fprintf(e.record, "# mini-rocket mock editor session: microseconds, then the commands sent in hex\n");
+  }
+  e.start = now_ns();
+  if(replay) {
+    run_replay(&e, argv[optind + 1]);
+  } else {
+    run_storm(&e);
+  }
+  if(e.record != NULL) {
+    fclose(e.record);
+  }
+
+  if(loopback) {
+    pthread_join(client, NULL);
+    // Commands arrive in order, so all were applied once the final probe was seen
+    long long done = atomic_load(&client_done);
+    double seconds = done > 0 ? (done - e.start) / 1e9 : 0;
+    if(seconds > 0) {
+      fprintf(stderr, "client: %lu commands applied in %.3f s, %.0f commands/s\n",
+	      e.commands, seconds, e.commands / seconds);
+    }
+  } else {
+    sleep(1);  // let the client read the tail before the connection closes
+  }
+  close(e.sock);
+  return 0;
+}
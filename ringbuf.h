@@ -1,10 +1,16 @@
 /**
  * Simple ringbuffer
  *
+ * The capacity is a power of two and read/write are free-running counters
+ * masked on access, so size is write - read. Data moves with at most two
+ * memcpy calls, one per contiguous span, and free space can be exposed as
+ * spans to receive into directly (ringbuf_free_spans + ringbuf_commit).
+ *
  * (C) orIgo 2021
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <string.h>
 #ifndef __RINGBUF_TYPE_H__
@@ -14,124 +20,169 @@ typedef struct __ringbuf_t {
   unsigned int write;
   unsigned int read;
   unsigned int max;
-  int size;
+  unsigned int mask;
 } ringbuf_t;
-#endif
 
-#ifdef RINGBUF_IMPLEMENTATION
-ringbuf_t *ringbuf_create(unsigned int max) {
-  ringbuf_t *r = malloc(sizeof(ringbuf_t));
-  memset(r, 0, sizeof(ringbuf_t));
-  r->buf = malloc(max);
-  memset(r->buf, 0x41, max);
-  r->max = max;
-  return r;
+static inline unsigned int ringbuf_size(ringbuf_t *r) {
+  return r->write - r->read;
 }
 
-void ringbuf_print(ringbuf_t *r) {
-  fprintf(stderr, "\n");
-  for(unsigned int i=0; i < r->max; i++) {
-    fprintf(stderr, "%02x|", r->buf[i]);
-  }
-  fprintf(stderr, "\n");
-  for(unsigned int i=0; i < r->max; i++) {
-    if(r->read == r->write) {
-      fprintf(stderr, "%s|", i==r->read?"RW":"  ");
-    } else {
-      fprintf(stderr, "%s|", i==r->read?"R^":(i==r->write?"W^":"  "));
-    }
-  }
-  fprintf(stderr, "\n");
-  fprintf(stderr, "\n");
-  fprintf(stderr, "R: %d  W:%d  S:%d\n", r->read, r->write, r->size);
-  fflush(stderr);
+static inline unsigned int ringbuf_space(ringbuf_t *r) {
+  return r->max - ringbuf_size(r);
 }
 
-void ringbuf_free(ringbuf_t *r) {
-  free(r->buf);
-  free(r);
+static inline void ringbuf_reset(ringbuf_t *r) {
+  r->read = r->write = 0;
 }
 
-void ringbuf_reset(ringbuf_t *r) {
-  r->read = r->write = 0;
+/**
+ * Returns the free space as up to two contiguous spans, in order. Fill
+ * them (e.g. with readv) and then ringbuf_commit the bytes written.
+ */
+static inline unsigned int ringbuf_free_spans(ringbuf_t *r,
+					      unsigned char **p1, unsigned int *n1,
+					      unsigned char **p2, unsigned int *n2) {
+  unsigned int w = r->write & r->mask;
+  unsigned int space = ringbuf_space(r);
+  unsigned int first = r->max - w < space ? r->max - w : space;
+  *p1 = r->buf + w;
+  *n1 = first;
+  *p2 = r->buf;
+  *n2 = space - first;
+  return space;
 }
 
-inline unsigned int ringbuf_size(ringbuf_t *r) {
-  return r->size;
+static inline void ringbuf_commit(ringbuf_t *r, unsigned int size) {
+  assert(size <= ringbuf_space(r));
+  r->write += size;
 }
 
-inline void ringbuf_write_byte(ringbuf_t *r, unsigned char c) {
-  r->buf[r->write] = c;
-  r->write = (r->write + 1) % r->max;
-  r->size++;
+static inline void ringbuf_write(ringbuf_t *r, const unsigned char *buf, unsigned int size) {
+  assert(size <= ringbuf_space(r));
+  unsigned int w = r->write & r->mask;
+  unsigned int first = r->max - w < size ? r->max - w : size;
+  memcpy(r->buf + w, buf, first);
+  memcpy(r->buf, buf + first, size - first);
+  r->write += size;
 }
 
-inline void ringbuf_write(ringbuf_t *r, unsigned char *buf, unsigned int size) {
-  unsigned int i = 0;
-  assert(size <= r->max - ringbuf_size(r));
-  while(size-- > 0) {
-    ringbuf_write_byte(r, buf[i++]);
-  }
+static inline void ringbuf_write_byte(ringbuf_t *r, unsigned char c) {
+  assert(ringbuf_space(r) >= 1);
+  r->buf[r->write++ & r->mask] = c;
 }
 
-inline unsigned char ringbuf_peek(ringbuf_t *r) {
-  return r->buf[r->read];
+static inline unsigned char ringbuf_peek(ringbuf_t *r) {
+  return r->buf[r->read & r->mask];
 }
 
-inline void ringbuf_skip(ringbuf_t *r, unsigned int n) {
-  for(int i = 0; i < n; i++) {
-    r->buf[(r->read + i) % r->max] = 0x42;
-  }
-  r->read = (r->read + n) % r->max;
-  r->size -= n;
-  assert(r->size >= 0);
+// Copies size bytes from the head without consuming them
+static inline void ringbuf_peek_bytes(ringbuf_t *r, unsigned char *buf, unsigned int size) {
+  assert(size <= ringbuf_size(r));
+  unsigned int rd = r->read & r->mask;
+  unsigned int first = r->max - rd < size ? r->max - rd : size;
+  memcpy(buf, r->buf + rd, first);
+  memcpy(buf + first, r->buf, size - first);
 }
 
-inline unsigned char ringbuf_read_byte(ringbuf_t *r)  {
+// Build with -DMR_RINGBUF_POISON to overwrite consumed bytes, which shows reads of stale data
+static inline void ringbuf_skip(ringbuf_t *r, unsigned int n) {
+  assert(n <= ringbuf_size(r));
+#ifdef MR_RINGBUF_POISON
+  unsigned int rd = r->read & r->mask;
+  unsigned int first = r->max - rd < n ? r->max - rd : n;
+  memset(r->buf + rd, 0x42, first);
+  memset(r->buf, 0x42, n - first);
+#endif
+  r->read += n;
+}
+
+static inline void ringbuf_read(ringbuf_t *r, unsigned char *buf, unsigned int size) {
+  ringbuf_peek_bytes(r, buf, size);
+  ringbuf_skip(r, size);
+}
+
+static inline unsigned char ringbuf_read_byte(ringbuf_t *r)  {
   assert(ringbuf_size(r) >= 1);
-  unsigned char ret = r->buf[r->read];
+  unsigned char ret = r->buf[r->read & r->mask];
   ringbuf_skip(r, 1);
   return ret;
 }
 
-unsigned long ringbuf_read_long(ringbuf_t *r) {
-  assert(ringbuf_size(r) >= sizeof(long));
-  return (ringbuf_read_byte(r) << 24) |
-    (ringbuf_read_byte(r) << 16) |
-    (ringbuf_read_byte(r) << 8) |
-    (ringbuf_read_byte(r));
+// Big-endian 32-bit word at the head, read with one load when contiguous
+static inline uint32_t ringbuf_read_be32(ringbuf_t *r) {
+  assert(ringbuf_size(r) >= 4);
+  uint32_t v;
+  unsigned int rd = r->read & r->mask;
+  if(rd + 4 <= r->max) {
+    memcpy(&v, r->buf + rd, 4);
+  } else {
+    ringbuf_peek_bytes(r, (unsigned char *)&v, 4);
+  }
+  ringbuf_skip(r, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return __builtin_bswap32(v);
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return v;
+#else
+  unsigned char *b = (unsigned char *)&v;
+  return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+#endif
 }
 
-float ringbuf_read_float(ringbuf_t *r) {
-  assert(ringbuf_size(r) >= sizeof(long));
-  float value = 0;
-  unsigned char *v = (unsigned char *)&value;
-  v[3]= ringbuf_read_byte(r);
-  v[2]= ringbuf_read_byte(r);
-  v[1]= ringbuf_read_byte(r);
-  v[0]= ringbuf_read_byte(r);
+static inline unsigned long ringbuf_read_long(ringbuf_t *r) {
+  return ringbuf_read_be32(r);
+}
+
+static inline float ringbuf_read_float(ringbuf_t *r) {
+  uint32_t v = ringbuf_read_be32(r);
+  float value;
+  memcpy(&value, &v, 4);
   return value;
 }
+#endif
 
-inline void ringbuf_read(ringbuf_t *r, unsigned char *buf, unsigned int size) {
-  unsigned int i = 0;
-  assert(size <= ringbuf_size(r));
-  while(size-- > 0) {
-    buf[i++] = ringbuf_read_byte(r);
+#ifdef RINGBUF_IMPLEMENTATION
+ringbuf_t *ringbuf_create(unsigned int max) {
+  unsigned int size = 1;
+  while(size < max) {
+    size <<= 1;
   }
+  ringbuf_t *r = malloc(sizeof(ringbuf_t));
+  memset(r, 0, sizeof(ringbuf_t));
+  r->buf = malloc(size);
+  memset(r->buf, 0x41, size);
+  r->max = size;
+  r->mask = size - 1;
+  return r;
+}
+
+void ringbuf_print(ringbuf_t *r) {
+  fprintf(stderr, "\n");
+  for(unsigned int i=0; i < r->max; i++) {
+    fprintf(stderr, "%02x|", r->buf[i]);
+  }
+  fprintf(stderr, "\n");
+  for(unsigned int i=0; i < r->max; i++) {
+    unsigned int rd = r->read & r->mask, wr = r->write & r->mask;
+    if(rd == wr) {
+      fprintf(stderr, "%s|", i==rd?"RW":"  ");
+    } else {
+      fprintf(stderr, "%s|", i==rd?"R^":(i==wr?"W^":"  "));
+    }
+  }
+  fprintf(stderr, "\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "R: %u  W:%u  S:%u\n", r->read & r->mask, r->write & r->mask, ringbuf_size(r));
+  fflush(stderr);
+}
+
+void ringbuf_free(ringbuf_t *r) {
+  free(r->buf);
+  free(r);
 }
 
 #else
 ringbuf_t	*ringbuf_create(unsigned int max);
-inline void		 ringbuf_reset(ringbuf_t *r);
-inline unsigned int	 ringbuf_size(ringbuf_t *r);
-inline void		 ringbuf_write_byte(ringbuf_t *r, unsigned char c);
-inline void		 ringbuf_write(ringbuf_t *r, unsigned char *buf, unsigned int size);
-inline unsigned char	 ringbuf_peek(ringbuf_t *r);
-inline void		 ringbuf_skip(ringbuf_t *r, unsigned int n);
-inline unsigned char	 ringbuf_read_byte(ringbuf_t *r);
-unsigned long	 ringbuf_read_long(ringbuf_t *r);
-float	         ringbuf_read_float(ringbuf_t *r);
 void		 ringbuf_free(ringbuf_t *r);
 void             ringbuf_print(ringbuf_t *r);
 
@@ -0,0 +1,39 @@
+/**
+ * Converts timelines between the text .rkt format and the binary format
+ * read by minirocket_read_binary(). The direction follows the input file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mini-rocket.h"
+
+int main(int argc, char *argv[]) {
+  if(argc != 3) {
+    fprintf(stderr, "Usage: %s <input.rkt|input.rkb> <output>\n", argv[0]);
+    exit(1);
+  }
+
+  FILE *fd = fopen(argv[1], "rb");
+  if(fd == NULL) {
+    perror(argv[1]);
+    exit(2);
+  }
+  char magic[4] = {0};
+  bool binary = fread(magic, 1, 4, fd) == 4 && memcmp(magic, "MRKB", 4) == 0;
+  fclose(fd);
+
+  mrocket_t *rocket = binary ? minirocket_read_binary(argv[1]) : minirocket_read_from_file(argv[1]);
+  if(rocket == NULL) {
+    fprintf(stderr, "Could not read %s\n", argv[1]);
+    exit(3);
+  }
+
+  bool ok = binary ? minirocket_write_to_file(rocket, argv[2]) : minirocket_write_binary(rocket, argv[2]);
+  minirocket_free(rocket);
+  if(!ok) {
+    fprintf(stderr, "Could not write %s\n", argv[2]);
+    exit(4);
+  }
+  return 0;
+}
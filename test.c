@@ -0,0 +1,88 @@
+/**
+ * Checks that need no editor:
+ *
+ *   make test
+ *
+ * Prints one line per failed check and exits non-zero if any failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mini-rocket.h"
+
+#define TEST_FILE "test-tmp.rkt"
+
+static unsigned int failures;
+
+static void check(bool ok, const char *what)
+{
+  if(!ok) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static bool same_value(float a, float b)
+{
+  return isnan(a) ? isnan(b) : a == b;
+}
+
+// Non-finite key values must survive a save and a reload
+static void test_nonfinite_roundtrip(void)
+{
+  const char text[] = "#a\n0 1 0\n1 2 0\n2 3 0\n3 4 0\n4 5 0\n";
+  const float values[] = {NAN, INFINITY, -INFINITY, -NAN, 0.5f};
+  mrocket_t *rocket = minirocket_read_from_memory(text, sizeof(text) - 1, "nonfinite");
+  check(rocket != NULL && rocket->numtracks == 1 && rocket->tracks[0]->numkeys == 5, "nonfinite: load");
+  if(rocket == NULL) {
+    return;
+  }
+  for(unsigned int i=0; i < 5; i++) {
+    rocket->tracks[0]->keys[i].value = values[i];
+  }
+  check(minirocket_write_to_file(rocket, TEST_FILE), "nonfinite: write");
+  minirocket_free(rocket);
+
+  rocket = minirocket_read_from_file(TEST_FILE);
+  remove(TEST_FILE);
+  check(rocket != NULL && rocket->numtracks == 1 && rocket->tracks[0]->numkeys == 5, "nonfinite: reload");
+  if(rocket == NULL) {
+    return;
+  }
+  for(unsigned int i=0; i < 5 && i < rocket->tracks[0]->numkeys; i++) {
+    check(same_value(rocket->tracks[0]->keys[i].value, values[i]), "nonfinite: value read back");
+  }
+  minirocket_free(rocket);
+}
+
+// Other spellings printf implementations use
+static void test_nonfinite_spellings(void)
+{
+  const char text[] = "#a\n0 inf 0\n1 -Infinity 0\n2 NaN 0\n3 -nan(ind) 0\n4 +INF 0\n";
+  mrocket_t *rocket = minirocket_read_from_memory(text, sizeof(text) - 1, "spellings");
+  check(rocket != NULL && rocket->numtracks == 1 && rocket->tracks[0]->numkeys == 5, "spellings: load");
+  if(rocket == NULL) {
+    return;
+  }
+  const mrocket_key_t *keys = rocket->tracks[0]->keys;
+  check(keys[0].value == INFINITY, "spellings: inf");
+  check(keys[1].value == -INFINITY, "spellings: -Infinity");
+  check(isnan(keys[2].value), "spellings: NaN");
+  check(isnan(keys[3].value), "spellings: -nan(ind)");
+  check(keys[4].value == INFINITY, "spellings: +INF");
+  minirocket_free(rocket);
+}
+
+int main(void)
+{
+  test_nonfinite_roundtrip();
+  test_nonfinite_spellings();
+  if(failures > 0) {
+    printf("%u checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}